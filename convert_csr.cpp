@@ -0,0 +1,82 @@
+#include <iostream>
+#include <cstdio>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "csr_parser.h"
+#include "csr_binary.h"
+
+using namespace std;
+
+/*
+
+Converts a CSR matrix between the .csr text format and the binary container
+(.csrb, see csr_binary.h). The input format is detected from stdin and the
+other one is written to stdout:
+
+	./ccsr < mat.csr > mat.csrb
+	./ccsr < mat.csrb > mat.csr
+
+Binary input has every checksum verified. Text output formats values like
+save_csr() ("%lf"), so text -> binary -> text reproduces a file written by
+sut or rcsr byte for byte.
+
+*/
+
+void binary_to_text(csr_text* text) {
+	const char* error = csr_binary_validate(text->data, text->length, 1);
+	if (error != NULL) {
+		cerr<<"Malformed binary CSR matrix: "<<error<<"."<<endl;
+		exit(1);
+	}
+	const csr_binary_header* header = (const csr_binary_header*) text->data;
+	int *vertices, *edges;
+	double *values;
+	csr_binary_arrays(text->data, &vertices, &edges, &values);
+
+	if (!write_csr_text(stdout, header->rows, header->columns, header->edges, vertices, edges, values)) {
+		cerr<<"Failed to write the CSR matrix."<<endl;
+		exit(1);
+	}
+}
+
+void text_to_binary(csr_text* text) {
+	int rows, columns, edge_count;
+	if (!parse_csr_metadata(text, &rows, &columns, &edge_count)) {
+		cerr<<"Malformed CSR matrix: expected a metadata line and VERTICES, EDGES and VALUES sections."<<endl;
+		exit(1);
+	}
+	vector<int> vertices(rows + 1), edges(edge_count);
+	vector<double> values(edge_count);
+	if (parse_csr_section(text, text->vertices_begin, text->vertices_end, vertices.data(), rows + 1) < 0 ||
+	    parse_csr_section(text, text->edges_begin, text->edges_end, edges.data(), edge_count) < 0 ||
+	    parse_csr_section(text, text->values_begin, text->values_end, values.data(), edge_count) < 0) {
+		cerr<<"Malformed CSR matrix: a section's entry count does not match the metadata line."<<endl;
+		exit(1);
+	}
+	if (!write_csr_binary(stdout, rows, columns, edge_count, vertices.data(), edges.data(), values.data())) {
+		cerr<<"Failed to write the CSR matrix."<<endl;
+		exit(1);
+	}
+}
+
+int main(int argc, char *argv[]) {
+
+	if (argc != 1 || isatty(STDOUT_FILENO)) {
+		cerr<<"Usage: "<<argv[0]<<" < in.csr > out.csrb, or "<<argv[0]<<" < in.csrb > out.csr"<<endl;
+		return 1;
+	}
+
+	csr_text text;
+	if (!read_csr_text(STDIN_FILENO, &text)) {
+		cerr<<"Failed to read the CSR matrix."<<endl;
+		return 1;
+	}
+
+	if (is_csr_binary(text.data, text.length)) binary_to_text(&text);
+	else text_to_binary(&text);
+
+	release_csr_text(&text);
+	return fclose(stdout) == 0 ? 0 : 1;
+}
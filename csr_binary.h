@@ -0,0 +1,200 @@
+#ifndef CSR_BINARY_H
+#define CSR_BINARY_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Binary CSR container (.csrb)
+//
+// A fixed header followed by the three CSR arrays, each starting on a
+// CSR_BINARY_ALIGN boundary of the file:
+//   header | vertices (rows + 1) | edges (edges) | values (edges)
+// A reorderer maps the file and points vertices, edges and values straight
+// into the mapping, so loading costs no parsing and no copy.
+//
+// Key invariants:
+// - Offsets are exactly those csr_binary_layout() computes from the counts
+// - Entries are native byte order; a foreign-endian file fails the version check
+// - index_width == sizeof(int) and value_width == sizeof(double) for every tool
+// - header_checksum covers the header bytes before it; each array has its own
+//   checksum, verified by csr_binary_validate() on request
+//
+// Usable from C (sut) and C++.
+#define CSR_BINARY_MAGIC "CSRBIN\n" // 8 bytes with the NUL
+#define CSR_BINARY_VERSION 1
+#define CSR_BINARY_ALIGN 64
+#define CSR_CHECKSUM_SEED 0xcbf29ce484222325ULL
+#define CSR_CHECKSUM_PRIME 0x100000001b3ULL
+
+typedef struct csr_binary_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_bytes; // Offset of the vertices array
+	uint32_t index_width; // Bytes per vertices / edges entry
+	uint32_t value_width; // Bytes per values entry
+	int64_t rows, columns, edges;
+	uint64_t vertices_offset, edges_offset, values_offset;
+	uint64_t file_bytes;
+	uint64_t vertices_checksum, edges_checksum, values_checksum;
+	uint64_t header_checksum;
+} csr_binary_header;
+
+uint64_t csr_binary_align(uint64_t offset) {
+	return (offset + CSR_BINARY_ALIGN - 1) / CSR_BINARY_ALIGN * CSR_BINARY_ALIGN;
+}
+
+/*
+
+64-bit checksum of a byte range: four independent multiply-xorshift lanes
+over 8-byte words, folded together with the length and the tail bytes.
+Every step is invertible, so any single corrupted word changes the result.
+
+*/
+uint64_t csr_checksum(const void* data, uint64_t bytes) {
+	const unsigned char* p = (const unsigned char*) data;
+	uint64_t lanes[4] = {CSR_CHECKSUM_SEED, CSR_CHECKSUM_SEED + 1, CSR_CHECKSUM_SEED + 2, CSR_CHECKSUM_SEED + 3};
+	uint64_t i = 0;
+	for (; i + 32 <= bytes; i += 32) {
+		for (int l=0; l<4; l++) {
+			uint64_t word;
+			memcpy(&word, p + i + 8 * l, 8);
+			lanes[l] = (lanes[l] ^ word) * CSR_CHECKSUM_PRIME;
+			lanes[l] ^= lanes[l] >> 29;
+		}
+	}
+	uint64_t h = CSR_CHECKSUM_SEED ^ bytes;
+	for (int l=0; l<4; l++) h = ((h ^ lanes[l]) * CSR_CHECKSUM_PRIME) ^ (lanes[l] >> 32);
+	for (; i<bytes; i++) h = (h ^ p[i]) * CSR_CHECKSUM_PRIME;
+	return h ^ (h >> 32);
+}
+
+/*
+
+Fill in everything but the checksums for a matrix of the given counts
+
+*/
+void csr_binary_layout(csr_binary_header* header, int64_t rows, int64_t columns, int64_t edges) {
+	memset(header, 0, sizeof(csr_binary_header));
+	memcpy(header->magic, CSR_BINARY_MAGIC, sizeof(header->magic));
+	header->version = CSR_BINARY_VERSION;
+	header->header_bytes = csr_binary_align(sizeof(csr_binary_header));
+	header->index_width = sizeof(int);
+	header->value_width = sizeof(double);
+	header->rows = rows;
+	header->columns = columns;
+	header->edges = edges;
+	header->vertices_offset = header->header_bytes;
+	header->edges_offset = csr_binary_align(header->vertices_offset + (rows + 1) * sizeof(int));
+	header->values_offset = csr_binary_align(header->edges_offset + edges * sizeof(int));
+	header->file_bytes = header->values_offset + edges * sizeof(double);
+}
+
+uint64_t csr_binary_header_checksum(const csr_binary_header* header) {
+	return csr_checksum(header, offsetof(csr_binary_header, header_checksum));
+}
+
+/*
+
+Write a CSR matrix to fp as a binary container. Returns 0 on a write error.
+
+*/
+int write_csr_binary(FILE* fp, int rows, int columns, int edge_count, const int* vertices, const int* edges, const double* values) {
+	csr_binary_header header;
+	csr_binary_layout(&header, rows, columns, edge_count);
+	header.vertices_checksum = csr_checksum(vertices, (rows + 1) * sizeof(int));
+	header.edges_checksum = csr_checksum(edges, edge_count * sizeof(int));
+	header.values_checksum = csr_checksum(values, edge_count * sizeof(double));
+	header.header_checksum = csr_binary_header_checksum(&header);
+
+	static const char padding[CSR_BINARY_ALIGN] = {0};
+	uint64_t written = 0;
+	int ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	written += sizeof(header);
+	ok = ok && fwrite(padding, 1, header.vertices_offset - written, fp) == header.vertices_offset - written;
+	ok = ok && fwrite(vertices, sizeof(int), rows + 1, fp) == (size_t)(rows + 1);
+	written = header.vertices_offset + (rows + 1) * sizeof(int);
+	ok = ok && fwrite(padding, 1, header.edges_offset - written, fp) == header.edges_offset - written;
+	ok = ok && fwrite(edges, sizeof(int), edge_count, fp) == (size_t)edge_count;
+	written = header.edges_offset + edge_count * sizeof(int);
+	ok = ok && fwrite(padding, 1, header.values_offset - written, fp) == header.values_offset - written;
+	ok = ok && fwrite(values, sizeof(double), edge_count, fp) == (size_t)edge_count;
+	return ok;
+}
+
+int is_csr_binary(const void* data, uint64_t length) {
+	return length >= 8 && memcmp(data, CSR_BINARY_MAGIC, 8) == 0;
+}
+
+/*
+
+Check that data[0, length) holds a well-formed container. Returns NULL if
+it does, else what is wrong. The array checksums cost a pass over the
+whole file and are only verified when verify_arrays is set.
+
+*/
+const char* csr_binary_validate(const void* data, uint64_t length, int verify_arrays) {
+	if (length < sizeof(csr_binary_header) || !is_csr_binary(data, length)) return "missing header";
+	const csr_binary_header* header = (const csr_binary_header*) data;
+	if (header->version != CSR_BINARY_VERSION) return "unsupported version or byte order";
+	if (header->header_checksum != csr_binary_header_checksum(header)) return "header checksum mismatch";
+	if (header->index_width != sizeof(int) || header->value_width != sizeof(double)) return "unsupported index or value width";
+	if (header->rows < 0 || header->rows >= INT_MAX || header->columns < 0 || header->columns > INT_MAX ||
+	    header->edges < 0 || header->edges > INT_MAX) return "counts out of range";
+
+	csr_binary_header expected;
+	csr_binary_layout(&expected, header->rows, header->columns, header->edges);
+	if (header->header_bytes != expected.header_bytes || header->vertices_offset != expected.vertices_offset ||
+	    header->edges_offset != expected.edges_offset || header->values_offset != expected.values_offset ||
+	    header->file_bytes != expected.file_bytes) return "array offsets do not match the counts";
+	if (header->file_bytes > length) return "file is truncated";
+
+	const char* base = (const char*) data;
+	const int* vertices = (const int*) (base + header->vertices_offset);
+	if (vertices[0] != 0 || vertices[header->rows] != header->edges) return "vertices do not span the edges";
+
+	if (verify_arrays) {
+		if (csr_checksum(base + header->vertices_offset, (header->rows + 1) * sizeof(int)) != header->vertices_checksum) return "vertices checksum mismatch";
+		if (csr_checksum(base + header->edges_offset, header->edges * sizeof(int)) != header->edges_checksum) return "edges checksum mismatch";
+		if (csr_checksum(base + header->values_offset, header->edges * sizeof(double)) != header->values_checksum) return "values checksum mismatch";
+	}
+	return NULL;
+}
+
+/*
+
+Point the CSR arrays into a validated container
+
+*/
+void csr_binary_arrays(void* data, int** vertices, int** edges, double** values) {
+	const csr_binary_header* header = (const csr_binary_header*) data;
+	*vertices = (int*) ((char*) data + header->vertices_offset);
+	*edges = (int*) ((char*) data + header->edges_offset);
+	*values = (double*) ((char*) data + header->values_offset);
+}
+
+/*
+
+Map fd if it is a regular file holding a binary container. Returns NULL
+otherwise, leaving fd where it was. The mapping is private and writable, so
+the arrays behave like ordinary memory; writes are never seen by the file.
+
+*/
+void* map_csr_binary(int fd, uint64_t* length) {
+	struct stat st;
+	char magic[8];
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || lseek(fd, 0, SEEK_CUR) != 0 ||
+	    pread(fd, magic, 8, 0) != 8 || !is_csr_binary(magic, 8)) return NULL;
+
+	void* mapping = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (mapping == MAP_FAILED) return NULL;
+	*length = st.st_size;
+	return mapping;
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef CSR_NORMALIZE_H
+#define CSR_NORMALIZE_H
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include "parallel_runtime.h"
+
+// CSR normalization
+//
+// The intersection kernels and scan loops assume every row's columns are
+// strictly increasing. Files from sut keep the .mtx line order within a row
+// and may repeat a column, so the loaders normalize in two stages:
+// - sort_csr_rows() sorts each row's columns in place, carrying values,
+//   and coalesces repeated columns by summing their values (in input
+//   order, so the sums are deterministic); rows already strictly increasing
+//   are only checked
+// - compact_csr_rows() moves the surviving nonzeros into fresh arrays, only
+//   needed when sort_csr_rows() coalesced any
+// Both run over edge-balanced blocks of whole rows (edge_balanced_blocks()).
+
+/*
+
+Sort and coalesce the nonzeros edges/values[begin, end) of one row,
+leaving the result at the front of the range. Returns the new degree.
+
+*/
+inline int normalize_csr_row(int* edges, double* values, int begin, int end, std::vector< std::pair<int, double> >& scratch, bool* sorted) {
+	*sorted = false;
+	bool increasing = true, ordered = true;
+	for (int e=begin+1; e<end; e++) {
+		if (edges[e] <= edges[e-1]) increasing = false;
+		if (edges[e] < edges[e-1]) {
+			ordered = false;
+			break;
+		}
+	}
+	if (increasing) return end - begin;
+
+	if (!ordered) {
+		scratch.clear();
+		for (int e=begin; e<end; e++) scratch.push_back(std::make_pair(edges[e], values[e]));
+		std::stable_sort(scratch.begin(), scratch.end(), [](const std::pair<int, double>& a, const std::pair<int, double>& b) {
+			return a.first < b.first;
+		});
+		for (int e=begin; e<end; e++) {
+			edges[e] = scratch[e - begin].first;
+			values[e] = scratch[e - begin].second;
+		}
+		*sorted = true;
+	}
+
+	int kept = begin;
+	for (int e=begin; e<end; e++) {
+		if (kept > begin && edges[kept-1] == edges[e]) {
+			values[kept-1] += values[e];
+		} else {
+			edges[kept] = edges[e];
+			values[kept] = values[e];
+			kept++;
+		}
+	}
+	return kept - begin;
+}
+
+/*
+
+Sort and coalesce every row in place. degrees[r] receives row r's new
+degree and *rows_sorted the number of rows that were out of order. Returns
+the number of nonzeros left.
+
+*/
+long long int sort_csr_rows(int rows, const int* vertices, int* edges, double* values, int* degrees, long long int grain, long long int* rows_sorted) {
+	std::vector<int> blocks = edge_balanced_blocks(vertices, rows, grain);
+	long long int sorted = 0;
+	long long int kept = parallel_sum((size_t)0, blocks.size() - 1, [&](size_t b) {
+		std::vector< std::pair<int, double> > scratch;
+		long long int block_kept = 0, block_sorted = 0;
+		for (int r=blocks[b]; r<blocks[b+1]; r++) {
+			bool row_sorted;
+			degrees[r] = normalize_csr_row(edges, values, vertices[r], vertices[r+1], scratch, &row_sorted);
+			block_kept += degrees[r];
+			block_sorted += row_sorted;
+		}
+		__atomic_fetch_add(&sorted, block_sorted, __ATOMIC_RELAXED);
+		return block_kept;
+	});
+	*rows_sorted = sorted;
+	return kept;
+}
+
+/*
+
+Copy the first degrees[r] nonzeros of every row into out_edges/out_values,
+sized for the total sort_csr_rows() returned, and their row pointer into
+out_vertices. Row starts come from a blocked parallel prefix sum over the
+degrees.
+
+*/
+void compact_csr_rows(int rows, const int* vertices, const int* edges, const double* values, const int* degrees, long long int grain,
+                      int* out_vertices, int* out_edges, double* out_values) {
+	std::vector<int> blocks = edge_balanced_blocks(vertices, rows, grain);
+	size_t count = blocks.size() - 1;
+
+	// Nonzeros per block, then the first output slot of each block
+	std::vector<long long int> block_starts(count + 1, 0);
+	parallel_for((size_t)0, count, [&](size_t b) {
+		long long int sum = 0;
+		for (int r=blocks[b]; r<blocks[b+1]; r++) sum += degrees[r];
+		block_starts[b+1] = sum;
+	});
+	for (size_t b=0; b<count; b++) block_starts[b+1] += block_starts[b];
+
+	parallel_for((size_t)0, count, [&](size_t b) {
+		long long int next = block_starts[b];
+		for (int r=blocks[b]; r<blocks[b+1]; r++) {
+			out_vertices[r] = next;
+			std::copy(edges + vertices[r], edges + vertices[r] + degrees[r], out_edges + next);
+			std::copy(values + vertices[r], values + vertices[r] + degrees[r], out_values + next);
+			next += degrees[r];
+		}
+	});
+	out_vertices[rows] = block_starts[count];
+}
+
+#endif
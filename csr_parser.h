@@ -0,0 +1,298 @@
+#ifndef CSR_PARSER_H
+#define CSR_PARSER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <charconv>
+#include <vector>
+#include "parallel_runtime.h"
+
+// Chunked parallel parser (and buffered writer) for the .csr text format
+//
+// The input is read whole, mapped when stdin is a regular file and read in
+// CSR_READ_BLOCK blocks otherwise. The metadata line is parsed and the
+// VERTICES / EDGES / VALUES marker lines are located by a parallel search.
+// Each section is then cut into newline-aligned chunks of about
+// CSR_PARSE_CHUNK bytes and parsed in two parallel passes: count the lines
+// of every chunk, prefix-sum the counts into output offsets, then convert
+// every line with std::from_chars straight into its slot.
+//
+// As with the getline/sscanf loaders, every line of a section is one entry:
+// leading blanks and a '+' are skipped, and a line that does not parse
+// (e.g. an empty one) reads as 0.
+#define CSR_READ_BLOCK (64 << 20)
+#define CSR_PARSE_CHUNK (1 << 20)
+
+typedef struct csr_text {
+	char* data;
+	size_t length;
+	void* mapping; // Non-NULL when data points into an mmap of the input
+	size_t mapping_length;
+	// Byte ranges of each section's lines, markers excluded
+	size_t vertices_begin, vertices_end;
+	size_t edges_begin, edges_end;
+	size_t values_begin, values_end;
+} csr_text;
+
+/*
+
+Read everything left on fd. Returns false on a read error.
+
+*/
+bool read_csr_text(int fd, csr_text* text) {
+	memset(text, 0, sizeof(csr_text));
+
+	struct stat st;
+	off_t position = lseek(fd, 0, SEEK_CUR);
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && position >= 0 && st.st_size > position) {
+		// Private and writable, so a binary container can be used in place (csr_binary.h)
+		void* mapping = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (mapping != MAP_FAILED) {
+			madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+			text->mapping = mapping;
+			text->mapping_length = st.st_size;
+			text->data = (char*) mapping + position;
+			text->length = st.st_size - position;
+			return true;
+		}
+	}
+
+	size_t capacity = CSR_READ_BLOCK;
+	text->data = (char*) malloc(capacity);
+	while (true) {
+		if (text->length == capacity) {
+			capacity *= 2;
+			text->data = (char*) realloc(text->data, capacity);
+		}
+		ssize_t got = read(fd, text->data + text->length, capacity - text->length);
+		if (got < 0) return false;
+		if (got == 0) return true;
+		text->length += got;
+	}
+}
+
+void release_csr_text(csr_text* text) {
+	if (text->mapping != NULL) munmap(text->mapping, text->mapping_length);
+	else free(text->data);
+	text->data = NULL;
+	text->mapping = NULL;
+}
+
+/*
+
+Offset of the first line at or after from that is exactly marker, or
+length if there is none. Chunks are searched in parallel, each reaching
+past its end far enough to catch a marker straddling the boundary.
+
+*/
+size_t find_marker_line(const csr_text* text, size_t from, const char* marker) {
+	// Search for "\n<marker>\n"; a marker on the very first line is matched separately
+	size_t marker_length = strlen(marker);
+	std::vector<char> needle(marker_length + 2);
+	needle[0] = '\n';
+	memcpy(&needle[1], marker, marker_length);
+	needle[marker_length + 1] = '\n';
+
+	if (from < text->length && text->length - from >= marker_length + 1 &&
+	    memcmp(text->data + from, &needle[1], marker_length + 1) == 0) return from;
+
+	size_t found = text->length;
+	size_t span = text->length - from;
+	long long int chunks = span / CSR_PARSE_CHUNK + 1;
+	parallel_for((long long int)0, chunks, [&](long long int k) {
+		size_t begin = from + k * CSR_PARSE_CHUNK;
+		size_t end = begin + CSR_PARSE_CHUNK + needle.size() - 1;
+		if (end > text->length) end = text->length;
+		if (begin >= end) return;
+		const char* hit = (const char*) memmem(text->data + begin, end - begin, needle.data(), needle.size());
+		if (hit == NULL) return;
+		size_t line = hit - text->data + 1;
+		size_t current = __atomic_load_n(&found, __ATOMIC_RELAXED);
+		while (line < current && !__atomic_compare_exchange_n(&found, &current, line, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	});
+	return found;
+}
+
+inline size_t next_line(const csr_text* text, size_t from) {
+	const char* newline = (const char*) memchr(text->data + from, '\n', text->length - from);
+	return newline ? newline - text->data + 1 : text->length;
+}
+
+/*
+
+Parse the metadata line and locate the three sections. Returns false if the
+layout is not metadata, VERTICES, EDGES, VALUES.
+
+*/
+bool parse_csr_metadata(csr_text* text, int* rows, int* columns, int* edges) {
+	const char* end = text->data + text->length;
+	const char* p = text->data;
+	int* fields[3] = {rows, columns, edges};
+	for (int f=0; f<3; f++) {
+		while (p < end && (*p == ' ' || *p == '\t')) p++;
+		std::from_chars_result parsed = std::from_chars(p, end, *fields[f]);
+		if (parsed.ec != std::errc()) return false;
+		p = parsed.ptr;
+	}
+
+	size_t vertices_marker = next_line(text, p - text->data);
+	if (find_marker_line(text, vertices_marker, "VERTICES") != vertices_marker) return false;
+	text->vertices_begin = next_line(text, vertices_marker);
+
+	text->vertices_end = find_marker_line(text, text->vertices_begin, "EDGES");
+	if (text->vertices_end == text->length) return false;
+	text->edges_begin = next_line(text, text->vertices_end);
+
+	text->edges_end = find_marker_line(text, text->edges_begin, "VALUES");
+	if (text->edges_end == text->length) return false;
+	text->values_begin = next_line(text, text->edges_end);
+	text->values_end = text->length;
+	return true;
+}
+
+/*
+
+Parse the line starting at p into value, returning the start of the next line
+
+*/
+template <typename value_type>
+inline const char* parse_csr_line(const char* p, const char* end, value_type* value) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '+')) p++;
+	*value = 0;
+	p = std::from_chars(p, end, *value).ptr;
+	while (p < end && *p != '\n') p++;
+	return p + 1;
+}
+
+/*
+
+Cut text[begin, end) into newline-aligned chunks of about CSR_PARSE_CHUNK
+bytes and count their lines in parallel. Chunk k spans
+text[bounds[k], bounds[k+1]) and its lines are numbered from offsets[k];
+returns the total number of lines.
+
+*/
+long long int split_csr_lines(const csr_text* text, size_t begin, size_t end, std::vector<size_t>& bounds, std::vector<long long int>& offsets) {
+	long long int chunks = (begin < end) ? (end - begin) / CSR_PARSE_CHUNK + 1 : 0;
+	bounds.assign(chunks + 1, end);
+	offsets.assign(chunks + 1, 0);
+	if (chunks == 0) return 0;
+
+	// Newline-aligned chunk boundaries
+	bounds[0] = begin;
+	parallel_for((long long int)1, chunks, [&](long long int k) {
+		size_t cut = begin + k * ((end - begin) / chunks);
+		const char* newline = (const char*) memchr(text->data + cut, '\n', end - cut);
+		bounds[k] = newline ? newline - text->data + 1 : end;
+	});
+	// A line longer than a chunk can carry a cut past the next one
+	for (long long int k=1; k<chunks; k++) if (bounds[k] < bounds[k-1]) bounds[k] = bounds[k-1];
+
+	// Lines per chunk; only a final line may lack its newline
+	parallel_for((long long int)0, chunks, [&](long long int k) {
+		const char* from = text->data + bounds[k];
+		long long int lines = 0;
+		for (size_t i=0; i<bounds[k+1]-bounds[k]; i++) lines += from[i] == '\n';
+		if (bounds[k+1] == end && bounds[k+1] > bounds[k] && text->data[end-1] != '\n') lines++;
+		offsets[k+1] = lines;
+	});
+	for (long long int k=0; k<chunks; k++) offsets[k+1] += offsets[k];
+	return offsets[chunks];
+}
+
+/*
+
+Parse every line of text[begin, end) into out, which holds count entries.
+Returns the number of lines, or -1 if there are not exactly count: extra
+lines would overrun out, and missing ones would leave entries unset.
+
+*/
+template <typename value_type>
+long long int parse_csr_section(const csr_text* text, size_t begin, size_t end, value_type* out, long long int count) {
+	std::vector<size_t> bounds;
+	std::vector<long long int> offsets;
+	long long int lines = split_csr_lines(text, begin, end, bounds, offsets);
+	if (lines != count) return -1;
+
+	// Convert each chunk's lines into their slots
+	parallel_for((long long int)0, (long long int)bounds.size() - 1, [&](long long int k) {
+		const char* p = text->data + bounds[k];
+		const char* chunk_end = text->data + bounds[k+1];
+		value_type* slot = out + offsets[k];
+		while (p < chunk_end) p = parse_csr_line(p, chunk_end, slot++);
+	});
+	return lines;
+}
+
+// Buffered writer for the .csr text format, formatting with std::to_chars
+typedef struct csr_text_writer {
+	FILE* fp;
+	std::vector<char> buffer;
+	size_t used;
+	bool ok;
+} csr_text_writer;
+
+#define CSR_WRITE_BLOCK (1 << 20) // Bytes formatted per fwrite
+#define CSR_NUMBER_BYTES 512 // A double under "%lf" can take over 300 digits
+
+inline void flush_csr_text(csr_text_writer* out) {
+	if (out->used > 0 && fwrite(out->buffer.data(), 1, out->used, out->fp) != out->used) out->ok = false;
+	out->used = 0;
+}
+
+inline void write_csr_line(csr_text_writer* out, const char* line) {
+	size_t length = strlen(line);
+	if (out->used + length > out->buffer.size()) flush_csr_text(out);
+	memcpy(out->buffer.data() + out->used, line, length);
+	out->used += length;
+}
+
+inline void write_csr_number(csr_text_writer* out, int value) {
+	if (out->used + CSR_NUMBER_BYTES > out->buffer.size()) flush_csr_text(out);
+	char* first = out->buffer.data() + out->used;
+	char* last = std::to_chars(first, first + CSR_NUMBER_BYTES - 1, value).ptr;
+	*last = '\n';
+	out->used = last + 1 - out->buffer.data();
+}
+
+// Same digits as "%lf"
+inline void write_csr_number(csr_text_writer* out, double value) {
+	if (out->used + CSR_NUMBER_BYTES > out->buffer.size()) flush_csr_text(out);
+	char* first = out->buffer.data() + out->used;
+	char* last = std::to_chars(first, first + CSR_NUMBER_BYTES - 1, value, std::chars_format::fixed, 6).ptr;
+	*last = '\n';
+	out->used = last + 1 - out->buffer.data();
+}
+
+/*
+
+Write a CSR matrix to fp in the .csr text format, byte for byte as
+save_csr() in sut and rcsr does. Returns false on a write error.
+
+*/
+bool write_csr_text(FILE* fp, int rows, int columns, int edge_count, const int* vertices, const int* edges, const double* values) {
+	csr_text_writer out;
+	out.fp = fp;
+	out.buffer.resize(CSR_WRITE_BLOCK);
+	out.used = 0;
+	out.ok = true;
+
+	char metadata[64];
+	snprintf(metadata, sizeof(metadata), "%d %d %d\n", rows, columns, edge_count);
+	write_csr_line(&out, metadata);
+	write_csr_line(&out, "VERTICES\n");
+	for (int i=0; i<rows + 1; i++) write_csr_number(&out, vertices[i]);
+	write_csr_line(&out, "EDGES\n");
+	for (int i=0; i<edge_count; i++) write_csr_number(&out, edges[i]);
+	write_csr_line(&out, "VALUES\n");
+	for (int i=0; i<edge_count; i++) write_csr_number(&out, values[i]);
+	flush_csr_text(&out);
+	return out.ok;
+}
+
+#endif
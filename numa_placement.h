@@ -0,0 +1,187 @@
+#ifndef NUMA_PLACEMENT_H
+#define NUMA_PLACEMENT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "parallel_runtime.h"
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#define NUMA_PLACEMENT_LINUX
+#endif
+
+// NUMA placement of the large shared arrays
+//
+// Linux places a page on the node of the thread that first writes it, so an
+// array filled by the loading thread sits entirely on that thread's node and
+// every worker on another socket reads it remotely. numa_malloc() and
+// numa_calloc() allocate page-aligned memory and place it by policy:
+// - NUMA_NONE: plain allocation, pages land wherever they are first written
+// - NUMA_FIRST_TOUCH: the pages are zeroed by a parallel_for over the array
+//   before it is returned, so the pages are spread across the nodes of the
+//   workers that zeroed them rather than all on the allocating thread's node
+// - NUMA_INTERLEAVE: the range is mbind()-interleaved across every node, so
+//   accesses from any worker are spread evenly over the memory controllers
+// Both return memory that free() releases. Arrays under NUMA_MIN_BYTES are
+// left to the allocator, since they share pages with other allocations.
+//
+// The syscalls are issued directly, so no libnuma is needed; on a kernel
+// without NUMA support mbind fails and the pages stay first-touch.
+#define NUMA_NONE 0
+#define NUMA_FIRST_TOUCH 1
+#define NUMA_INTERLEAVE 2
+#define NUMA_MIN_BYTES (1 << 20)
+#define NUMA_MAX_NODES 64
+#define NUMA_REPORT_PAGES 4096 // Pages sampled per array by numa_report()
+
+int numa_policy = NUMA_NONE;
+
+inline size_t numa_page_size() {
+	static size_t page = sysconf(_SC_PAGESIZE);
+	return page;
+}
+
+/*
+
+Parse a sysfs CPU or node list such as "0-3,8,10-11"
+
+*/
+std::vector<int> parse_sysfs_list(const char* path) {
+	std::vector<int> ids;
+	FILE* f = fopen(path, "r");
+	if (f == NULL) return ids;
+
+	int first, last;
+	while (fscanf(f, "%d", &first) == 1) {
+		last = first;
+		int c = fgetc(f);
+		if (c == '-') {
+			if (fscanf(f, "%d", &last) != 1) break;
+			c = fgetc(f);
+		}
+		for (int i=first; i<=last; i++) ids.push_back(i);
+		if (c != ',') break;
+	}
+	fclose(f);
+	return ids;
+}
+
+std::vector<int> numa_online_nodes() {
+	std::vector<int> nodes = parse_sysfs_list("/sys/devices/system/node/online");
+	if (nodes.empty()) nodes.push_back(0);
+	return nodes;
+}
+
+std::vector<int> numa_node_cpus(int node) {
+	char path[128];
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	return parse_sysfs_list(path);
+}
+
+/*
+
+CPUs in the order workers are pinned to them: compact fills each node
+before the next, spread deals them round-robin across nodes
+
+*/
+std::vector<int> numa_pin_order(bool spread) {
+	std::vector<int> nodes = numa_online_nodes();
+	std::vector< std::vector<int> > node_cpus;
+	for (size_t n=0; n<nodes.size(); n++) node_cpus.push_back(numa_node_cpus(nodes[n]));
+
+	std::vector<int> order;
+	if (!spread) {
+		for (size_t n=0; n<node_cpus.size(); n++) order.insert(order.end(), node_cpus[n].begin(), node_cpus[n].end());
+	} else {
+		for (size_t i=0; ; i++) {
+			bool any = false;
+			for (size_t n=0; n<node_cpus.size(); n++) {
+				if (i >= node_cpus[n].size()) continue;
+				order.push_back(node_cpus[n][i]);
+				any = true;
+			}
+			if (!any) break;
+		}
+	}
+
+	// No sysfs topology: every online CPU in order
+	if (order.empty()) for (long c=0; c<sysconf(_SC_NPROCESSORS_ONLN); c++) order.push_back(c);
+	return order;
+}
+
+void* numa_malloc(size_t bytes) {
+	if (numa_policy == NUMA_NONE || bytes < NUMA_MIN_BYTES) return malloc(bytes);
+
+	size_t page = numa_page_size();
+	void* ptr = NULL;
+	if (posix_memalign(&ptr, page, bytes) != 0) return NULL;
+	char* base = (char*) ptr;
+	long long int pages = (bytes + page - 1) / page;
+
+#ifdef NUMA_PLACEMENT_LINUX
+	if (numa_policy == NUMA_INTERLEAVE) {
+		std::vector<int> nodes = numa_online_nodes();
+		unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+		for (size_t n=0; n<nodes.size(); n++)
+			if (nodes[n] < NUMA_MAX_NODES) mask[nodes[n] / (8 * sizeof(unsigned long))] |= 1UL << (nodes[n] % (8 * sizeof(unsigned long)));
+		syscall(SYS_mbind, base, pages * page, MPOL_INTERLEAVE, mask, NUMA_MAX_NODES + 1, 0);
+	}
+#endif
+
+	// Fault every page in from the workers; under interleave the policy decides the node
+	parallel_for((long long int)0, pages, [&](long long int p) {
+		size_t start = p * page;
+		memset(base + start, 0, (start + page <= bytes) ? page : bytes - start);
+	});
+	return ptr;
+}
+
+void* numa_calloc(size_t count, size_t size) {
+	// numa_malloc() already zeroed whatever it placed
+	if (numa_policy != NUMA_NONE && count * size >= NUMA_MIN_BYTES) return numa_malloc(count * size);
+	return calloc(count, size);
+}
+
+/*
+
+Print how the pages of an array are spread across nodes, sampling up to
+NUMA_REPORT_PAGES pages evenly: per node the share of sampled pages, plus
+pages not yet faulted in
+
+*/
+void numa_report(const char* name, const void* ptr, size_t bytes) {
+	if (ptr == NULL || bytes == 0) return;
+	size_t page = numa_page_size();
+	size_t first = ((size_t) ptr) / page, last = (((size_t) ptr) + bytes - 1) / page;
+	long long int pages = last - first + 1;
+	long long int samples = pages < NUMA_REPORT_PAGES ? pages : NUMA_REPORT_PAGES;
+
+	std::vector<void*> addresses(samples);
+	std::vector<int> status(samples, -1);
+	for (long long int i=0; i<samples; i++) addresses[i] = (void*) ((first + i * pages / samples) * page);
+
+	long long int counts[NUMA_MAX_NODES] = {0};
+	long long int absent = 0;
+#ifdef NUMA_PLACEMENT_LINUX
+	// move_pages without target nodes only reports where each page is
+	if (syscall(SYS_move_pages, 0, samples, addresses.data(), NULL, status.data(), 0) != 0) {
+		printf("NUMA %s: placement unavailable\n", name);
+		return;
+	}
+#endif
+	for (long long int i=0; i<samples; i++) {
+		if (status[i] >= 0 && status[i] < NUMA_MAX_NODES) counts[status[i]]++;
+		else absent++;
+	}
+
+	printf("NUMA %s: %lld pages (%lld sampled)", name, pages, samples);
+	for (int n=0; n<NUMA_MAX_NODES; n++)
+		if (counts[n] > 0) printf(", node %d %.1f%%", n, 100.0 * counts[n] / samples);
+	if (absent > 0) printf(", not faulted %.1f%%", 100.0 * absent / samples);
+	printf("\n");
+}
+
+#endif
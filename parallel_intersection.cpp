@@ -4,12 +4,15 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <unistd.h>
 #include <vector>
 #include <algorithm>
 #include <functional>
 #include <chrono>
-#include <cilk/cilk.h>
-#include <cilk/reducer_opadd.h>
+#include "row_intersection.h"
+#include "csr_parser.h"
+#include "csr_binary.h"
+#include "csr_normalize.h"
 
 #define HEAP_ROOT 0
 #define LEFT_CHILD(x) 2*x+1
@@ -41,6 +44,8 @@ int metadata_columns = 0;
 int metadata_edges = 0;
 int *vertices, *edges;
 double *values;
+csr_text csr_input; // Input a binary container's arrays point into
+bool csr_in_place = false; // vertices, edges and values live in csr_input
 
 // A permutation of the rows of the CSR representation.
 // *permutation must be allocated to length metadata_rows
@@ -48,7 +53,32 @@ int *permutation;
 
 /*
 
-Load a .csr asymmetric CSR representation from stdin
+Load a binary CSR container (see csr_binary.h) read by read_csr_text().
+The arrays are used in place in the input mapping, with no copy.
+
+*/
+void load_csr_binary(csr_text* text) {
+
+	const char* error = csr_binary_validate(text->data, text->length, 0);
+	if (error != NULL) {
+		cerr<<"Malformed binary CSR matrix: "<<error<<"."<<endl;
+		exit(1);
+	}
+	const csr_binary_header* header = (const csr_binary_header*) text->data;
+	metadata_rows = header->rows;
+	metadata_columns = header->columns;
+	metadata_edges = header->edges;
+	cout<<"- Binary container. Rows: "<<metadata_rows<<" Columns: "<<metadata_columns<<" Edges: "<<metadata_edges<<endl;
+
+	csr_binary_arrays(text->data, &vertices, &edges, &values);
+	csr_input = *text;
+	csr_in_place = true;
+}
+
+/*
+
+Load a .csr asymmetric CSR representation from stdin, or a binary
+container (.csrb)
 
 Format:
 * Metadata line: rows columns edges
@@ -59,19 +89,29 @@ Format:
 * VALUES
 * List of edge values each followed by \n
 
+The sections are parsed in parallel chunks (see csr_parser.h).
+
 */
 void load_mtx_csr_from_stdin() {
 
-	string serialized_data;
+	csr_text text;
 
 	cout<<"Loading CSR matrix..."<<endl;
-	cout<<"- Loading metadata line.\n"<<endl;
-	getline(cin,serialized_data);
-	cout<<serialized_data<<endl;
+	if (!read_csr_text(STDIN_FILENO, &text)) {
+		cerr<<"Failed to read the CSR matrix."<<endl;
+		exit(1);
+	}
+	if (is_csr_binary(text.data, text.length)) {
+		load_csr_binary(&text);
+		return;
+	}
 
-	// Extract metadata
+	// Extract metadata and find the sections
 	cout<<"- Extracting."<<endl;
-	sscanf(serialized_data.c_str(), "%d %d %d", &metadata_rows, &metadata_columns, &metadata_edges);
+	if (!parse_csr_metadata(&text, &metadata_rows, &metadata_columns, &metadata_edges)) {
+		cerr<<"Malformed CSR matrix: expected a metadata line and VERTICES, EDGES and VALUES sections."<<endl;
+		exit(1);
+	}
 
 	cout<<"- Rows: "<<metadata_rows<<" Columns: "<<metadata_columns<<" Edges: "<<metadata_edges<<endl;
 
@@ -82,42 +122,52 @@ void load_mtx_csr_from_stdin() {
 	values = (double *) malloc(metadata_edges * sizeof(double));
 	vertices = (int  *) malloc((metadata_rows + 1) * sizeof(int));
 
-	cout<<"- Reading vertices..."<<endl;
-
-	// Read VERTICES preamble
-	getline(cin,serialized_data);
-        assert(strcmp(serialized_data.c_str(),"VERTICES") == 0);
-
-	// Read vertices until we hit EDGES preamble
-	int i=0;
-	//cout<<"metadata_rows: "<<metadata_rows<<endl;
-	while (getline(cin,serialized_data) && strcmp(serialized_data.c_str(),"EDGES") != 0) {
- 		assert(i < (metadata_rows+1));
-		int vertex_edge_edx = 0;
-		sscanf(serialized_data.c_str(), "%d", &vertex_edge_edx);
-		vertices[i] = vertex_edge_edx;
-		i++;
-	}
+	cout<<"- Parsing sections..."<<endl;
 
-	// Read edges until we hit VALUES preamble
-	i=0;
-	while (getline(cin,serialized_data) && strcmp(serialized_data.c_str(),"VALUES") != 0) {
-		assert(i < metadata_edges);
-		int edge_destination_vertex = 0;
-		sscanf(serialized_data.c_str(), "%d", &edge_destination_vertex);
-		edges[i] = edge_destination_vertex;
-		i++;
+	// Each section in parallel chunks
+	if (parse_csr_section(&text, text.vertices_begin, text.vertices_end, vertices, metadata_rows + 1) < 0 ||
+	    parse_csr_section(&text, text.edges_begin, text.edges_end, edges, metadata_edges) < 0 ||
+	    parse_csr_section(&text, text.values_begin, text.values_end, values, metadata_edges) < 0) {
+		cerr<<"Malformed CSR matrix: a section's entry count does not match the metadata line."<<endl;
+		exit(1);
 	}
 
-	// Read values until EOF
-	i=0;
-	while (getline(cin,serialized_data)) {
-		assert(i < metadata_edges);
-		double value = 0;
-		sscanf(serialized_data.c_str(), "%lf", &value);
-		values[i] = value;
-		i++;
+	release_csr_text(&text);
+}
+
+/*
+
+Sort every row's columns and coalesce repeated ones (see csr_normalize.h),
+which the merge-based kernels rely on
+
+*/
+void normalize_csr() {
+
+	vector<int> degrees(metadata_rows);
+	long long int rows_sorted = 0;
+	long long int kept = sort_csr_rows(metadata_rows, vertices, edges, values, degrees.data(), 0, &rows_sorted);
+
+	if (kept < metadata_edges) {
+		int* normal_vertices = (int *) malloc((metadata_rows + 1) * sizeof(int));
+		int* normal_edges = (int *) malloc(kept * sizeof(int));
+		double* normal_values = (double *) malloc(kept * sizeof(double));
+		compact_csr_rows(metadata_rows, vertices, edges, values, degrees.data(), 0, normal_vertices, normal_edges, normal_values);
+
+		if (csr_in_place) {
+			release_csr_text(&csr_input);
+			csr_in_place = false;
+		} else {
+			free(vertices);
+			free(edges);
+			free(values);
+		}
+		vertices = normal_vertices;
+		edges = normal_edges;
+		values = normal_values;
 	}
+
+	cout<<"- Normalized: "<<rows_sorted<<" rows sorted, "<<(metadata_edges - kept)<<" repeated nonzeros coalesced"<<endl;
+	metadata_edges = kept;
 }
 
 /*
@@ -434,61 +484,76 @@ void print_permutation() {
 }
 
 void free_all() {
-	free(vertices);
-	free(edges);
-	free(values);
+	if (csr_in_place) {
+		release_csr_text(&csr_input);
+	} else {
+		free(vertices);
+		free(edges);
+		free(values);
+	}
 	free(permutation);
 }
 
-void parallel_row_intersection_helper(){
-
-	//int* intersection_vector = (int*)calloc(metadata_columns, sizeof(int));
-	cilk::reducer_opadd<long long int> sum;
-
-	long long int row_0_edge_count = vertices[1] - vertices[0];
-	//cout<<"row_0_edge_count: "<<row_0_edge_count<<endl;
-	long long int row_1_edge_count = vertices[2] - vertices[1];
-        //cout<<"row_1_edge_count: "<<row_1_edge_count<<endl;
-        long long int total_edge_combinations = row_0_edge_count*row_1_edge_count;
-	//cout<<"total_edge_combinations: "<<total_edge_combinations<<endl;
-	cilk_for (long long int r=0; r<total_edge_combinations; r++) {
-		long long int r0_pos = r % row_0_edge_count + ((long long int)vertices[0]);
-		long long int r1_pos = ((long long int)r/row_0_edge_count) + ((long long int)vertices[1]);
-		long long int r0_coord = edges[r0_pos];
-		long long int r1_coord = edges[r1_pos];
-		
-		if (r0_coord == r1_coord) {
-			*sum += 1;
-		}
-	}
-	cilk_sync;
+// Intersection kernel under benchmark, selected with -k
+long long int (*intersection_kernel)(const int*, int, const int*, int) = intersect_all_pairs;
 
-	sum.get_value();
+// Bitmap rows for -k hybrid (see row_intersection.h)
+row_bitmaps bitmaps;
+bool use_hybrid = false;
 
-	//cout<<"Sum: "<<sum.get_value()<<endl;
+long long int parallel_row_intersection_helper(){
+	if (use_hybrid) return hybrid_row_intersection(&bitmaps, vertices, edges, 0, 1);
+	return intersection_kernel(&edges[vertices[0]], vertices[1] - vertices[0], &edges[vertices[1]], vertices[2] - vertices[1]);
 }
 
 void parallel_row_intersection() {
         long long int niter=metadata_columns*metadata_columns;
-
         auto t1 = high_resolution_clock::now();
 
-        cilk_for(long long int kdx=0; kdx < niter; kdx++) {
-		parallel_row_intersection_helper();
-        }
-	cilk_sync;
+        long long int sum = parallel_sum((long long int)0, niter, [&](long long int) {
+		return parallel_row_intersection_helper();
+        });
 
         auto t2 = high_resolution_clock::now();
 
         auto ms_int = duration_cast<milliseconds>(t2-t1);
 
         cout<<"Intersection runtime: "<< ms_int.count() << endl;
+        cout<<"Intersection size: "<< (niter > 0 ? sum / niter : 0) << endl;
+}
+
+void print_usage(char *prog) {
+	cerr<<"Usage: "<<prog<<" [-k allpairs|merge|simd|gallop|mergepath|auto|hybrid] < mat.csr"<<endl;
+	cerr<<"  -k  intersection kernel for rows 0 and 1 (default: allpairs)"<<endl;
+	cerr<<"Parallel runtime: "<<PARALLEL_RUNTIME_NAME<<endl;
 }
 
-int main() {
+int main(int argc, char *argv[]) {
+	int opt;
+	while ((opt = getopt(argc, argv, "k:")) != -1) {
+		switch (opt) {
+			case 'k':
+				if (strcmp(optarg, "allpairs") == 0) intersection_kernel = intersect_all_pairs;
+				else if (strcmp(optarg, "merge") == 0) intersection_kernel = intersect_merge;
+				else if (strcmp(optarg, "simd") == 0) intersection_kernel = intersect_merge_simd;
+				else if (strcmp(optarg, "gallop") == 0) intersection_kernel = intersect_gallop;
+				else if (strcmp(optarg, "mergepath") == 0) intersection_kernel = intersect_merge_path;
+				else if (strcmp(optarg, "auto") == 0) intersection_kernel = row_intersection_count;
+				else if (strcmp(optarg, "hybrid") == 0) use_hybrid = true;
+				else {
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+			default: print_usage(argv[0]); return 1;
+		}
+	}
+
 	cout<<"Loading..."<<endl;
 	load_mtx_csr_from_stdin();
+	normalize_csr();
 	print_csr();
+	if (use_hybrid) build_row_bitmaps(&bitmaps, vertices, edges, metadata_rows, metadata_columns, BITMAP_DEFAULT_DENSITY);
 //	serial_row_reorder();
 	cout<<"Intersecting rows..."<<endl;
 	parallel_row_intersection();
@@ -4,13 +4,19 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <unistd.h>
 #include <vector>
 #include <algorithm>
 #include <functional>
 #include <chrono>
-#include <cilk/cilk.h>
-#include <cilk/reducer_opadd.h>
-#include <cilk/reducer_max.h>
+#include <queue>
+#include "parallel_runtime.h"
+#include "row_intersection.h"
+#include "csr_parser.h"
+#include "csr_binary.h"
+#include "csr_normalize.h"
+#include "tournament_tree.h"
+#include "numa_placement.h"
 
 #define HEAP_ROOT 0
 #define LEFT_CHILD(x) 2*x+1
@@ -42,14 +48,204 @@ int metadata_columns = 0;
 int metadata_edges = 0;
 int *vertices, *edges;
 double *values;
+csr_text csr_input; // Input a binary container's arrays point into
+bool csr_in_place = false; // vertices, edges and values live in csr_input
 
 // A permutation of the rows of the CSR representation.
 // *permutation must be allocated to length metadata_rows
 int *permutation;
 
+// Inverted column index (CSC transpose of vertices/edges)
+// *col_vertices must be allocated to length metadata_columns + 1
+// *col_rows must be allocated to length metadata_edges
+//
+// Key invariants:
+// - col_rows[col_vertices[c]] .. col_rows[col_vertices[c+1]-1] are the rows
+//   holding a nonzero in column c
+// - Rows are listed in ascending order and at most once per column
+// - The last element of col_vertices is the number of distinct (row, column)
+//   pairs, which is at most metadata_edges
+//
+int *col_vertices, *col_rows;
+
+// Algorithm tuning parameter
+int window = 10;
+
+// Per-loop grains, set with -g
+//
+// The row loops over CSR nonzeros are cut into chunks of equal edge work by
+// parallel_for_edges() / edge_balanced_blocks(), and their grains count
+// nonzeros plus one per row; 0 picks a grain from the worker count.
+// speculation_grain is the rows per block of the speculative top-k scans.
+long long int intersect_grain = 0; // Intersect engine candidate pass
+long long int minhash_grain = 0; // MinHash signatures
+long long int union_grain = 0; // Union-find over the row-column graph
+long long int lp_grain = 0; // Label-propagation blocks
+long long int normalize_grain = 0; // Row sorting and coalescing after loading
+int speculation_grain = 4096;
+
+// Hub-column capping
+// *col_stride must be allocated to length metadata_columns
+//
+// col_stride[c] is the step taken through column c's row list when applying
+// affinity updates: 1 visits every row, k > 1 visits a fixed sample of every
+// k-th row, and 0 skips the column. Increments and window-eviction decrements
+// use the same stride, so they always touch the same rows.
+#define HUB_SKIP 0
+#define HUB_SAMPLE 1
+int hub_degree = 0; // Columns shared by more rows than this are hubs, 0 disables capping
+int hub_mode = HUB_SKIP;
+int *col_stride;
+
+// MinHash/LSH approximate reordering
+// *signatures must be allocated to length metadata_rows * minhash_bands * minhash_band_rows
+// *row_chunks must be allocated to length minhash_bands * metadata_rows
+//
+// Key invariants:
+// - Signature entry i of row r is the minimum of hash i over the row's columns
+// - Each LSH bucket (rows agreeing on all minhash_band_rows entries of a band)
+//   is split into chunks of at most MINHASH_BUCKET_CAP consecutive rows
+// - chunk_rows[chunk_offsets[k]] .. chunk_rows[chunk_offsets[k+1]-1] are the rows of chunk k
+// - row_chunks[b*metadata_rows + r] is row r's chunk in band b, or -1 if it has no bucket-mates
+#define MINHASH_BUCKET_CAP 256
+int minhash_bands = 16;
+int minhash_band_rows = 2;
+unsigned int *signatures;
+vector<int> chunk_offsets, chunk_rows;
+int *row_chunks;
+
+// Connected components of the row-column bipartite graph
+// *component_offsets must be allocated to length components + 1
+// *component_rows must be allocated to length metadata_rows
+//
+// Key invariants:
+// - component_rows[component_offsets[k]] .. component_rows[component_offsets[k+1]-1]
+//   are the rows of component k, in ascending order
+// - Components are ordered by their smallest row, so component 0 holds row 0
+int components = 0;
+int *component_offsets, *component_rows;
+
+// Balanced row partitions for partition-and-stitch
+// *partition_of must be allocated to length metadata_rows
+// *partition_offsets must be allocated to length partitions + 1
+// *partition_rows must be allocated to length metadata_rows
+//
+// Key invariants:
+// - partition_rows[partition_offsets[p]] .. partition_rows[partition_offsets[p+1]-1]
+//   are the rows with partition_of[r] == p, in ascending order
+// - No partition holds more than (1 + PARTITION_IMBALANCE) * metadata_rows / partitions rows
+#define PARTITION_IMBALANCE 0.05
+#define LP_ITERATIONS 5
+#define LP_NEIGHBOR_CAP 64 // Rows sampled from each column when voting
+int partitions = 8;
+int *partition_of, *partition_offsets, *partition_rows;
+
+// Relaxed concurrent priority queue (MultiQueue)
+//
+// Key invariants:
+// - Every un-reordered row has an entry holding its current affinity in one
+//   of the queues; other entries for it are stale and dropped when popped
+// - top is the key of a queue's best entry, or -1 when it is empty
+#define MULTIQUEUE_FACTOR 2 // Queues per worker
+#define MULTIQUEUE_BIAS (1LL << 40) // Starting affinity of unplaced rows in the multiqueue engine
+int multiqueue_workers = 4;
+
+typedef struct relaxed_queue {
+	char lock;
+	long long int top;
+	priority_queue< pair<long long int, int> > heap; // (affinity, row), possibly stale
+} relaxed_queue;
+
+vector<relaxed_queue> multiqueue;
+
+// Speculative top-k selection
+int speculation_k = 8; // Candidates taken from each top-k scan
+bool speculation_relaxed = false; // Commit whole batches without validation
+
+// Sparse accumulator (SPA) scratch arenas
+//
+// Key invariants:
+// - Column c is marked in an arena iff column_epoch[c] == epoch, so bumping
+//   the epoch clears every mark in O(1); marks are only written between
+//   passes, so every worker of a pass can probe them read-only
+// - touched_rows[0] .. touched_rows[touched_count-1] is the arena's current
+//   touched-row list; touched_rows has room for every row
+// - row_round holds the round stamps that keep each row in the touched list
+//   at most once per round
+// - The intersect and speculative engines share one arena among all workers
+//   of a step, so the touched list is appended with an atomic fetch-add and
+//   the stamps are swapped with an atomic exchange; the multiqueue gives each
+//   worker its own arena
+// - init_spa_arenas() allocates them once per run, so the reorder loops
+//   reuse them without allocating
+typedef struct spa_arena {
+	int epoch;
+	int touched_count;
+	vector<int> column_epoch;
+	vector<int> touched_rows;
+	vector<int> row_round;
+} spa_arena;
+
+vector<spa_arena> spa_arenas;
+
+// Bitmaps for rows at least bitmap_density dense (see row_intersection.h)
+double bitmap_density = BITMAP_DEFAULT_DENSITY;
+row_bitmaps bitmaps;
+
+// NUMA placement (see numa_placement.h) and worker pinning
+#define PIN_NONE 0
+#define PIN_COMPACT 1
+#define PIN_SPREAD 2
+int pin_mode = PIN_NONE;
+bool placement_report = false; // Print where the large arrays' pages sit
+
+/*
+
+Load a binary CSR container (see csr_binary.h) read by read_csr_text().
+The arrays are used in place in the input mapping, except under a NUMA
+policy (-N), where they are copied into placed arrays instead: page-cache
+pages cannot be moved to the nodes of their workers.
+
+*/
+void load_csr_binary(csr_text* text) {
+
+	const char* error = csr_binary_validate(text->data, text->length, 0);
+	if (error != NULL) {
+		cerr<<"Malformed binary CSR matrix: "<<error<<"."<<endl;
+		exit(1);
+	}
+	const csr_binary_header* header = (const csr_binary_header*) text->data;
+	metadata_rows = header->rows;
+	metadata_columns = header->columns;
+	metadata_edges = header->edges;
+	cout<<"- Binary container. Rows: "<<metadata_rows<<" Columns: "<<metadata_columns<<" Edges: "<<metadata_edges<<endl;
+
+	int *in_vertices, *in_edges;
+	double *in_values;
+	csr_binary_arrays(text->data, &in_vertices, &in_edges, &in_values);
+
+	if (numa_policy == NUMA_NONE) {
+		vertices = in_vertices;
+		edges = in_edges;
+		values = in_values;
+		csr_input = *text;
+		csr_in_place = true;
+		return;
+	}
+
+	edges = (int *) numa_malloc(metadata_edges * sizeof(int));
+	values = (double *) numa_malloc(metadata_edges * sizeof(double));
+	vertices = (int  *) numa_malloc((metadata_rows + 1) * sizeof(int));
+	memcpy(vertices, in_vertices, (metadata_rows + 1) * sizeof(int));
+	memcpy(edges, in_edges, metadata_edges * sizeof(int));
+	memcpy(values, in_values, metadata_edges * sizeof(double));
+	release_csr_text(text);
+}
+
 /*
 
-Load a .csr asymmetric CSR representation from stdin
+Load a .csr asymmetric CSR representation from stdin, or a binary
+container (.csrb)
 
 Format:
 * Metadata line: rows columns edges
@@ -60,65 +256,106 @@ Format:
 * VALUES
 * List of edge values each followed by \n
 
+The sections are parsed in parallel chunks (see csr_parser.h).
+
 */
 void load_mtx_csr_from_stdin() {
 
-	string serialized_data;
+	csr_text text;
 
 	cout<<"Loading CSR matrix..."<<endl;
-	cout<<"- Loading metadata line.\n"<<endl;
-	getline(cin,serialized_data);
-	cout<<serialized_data<<endl;
+	if (!read_csr_text(STDIN_FILENO, &text)) {
+		cerr<<"Failed to read the CSR matrix."<<endl;
+		exit(1);
+	}
+	if (is_csr_binary(text.data, text.length)) {
+		load_csr_binary(&text);
+		return;
+	}
 
-	// Extract metadata
+	// Extract metadata and find the sections
 	cout<<"- Extracting."<<endl;
-	sscanf(serialized_data.c_str(), "%d %d %d", &metadata_rows, &metadata_columns, &metadata_edges);
+	if (!parse_csr_metadata(&text, &metadata_rows, &metadata_columns, &metadata_edges)) {
+		cerr<<"Malformed CSR matrix: expected a metadata line and VERTICES, EDGES and VALUES sections."<<endl;
+		exit(1);
+	}
 
 	cout<<"- Rows: "<<metadata_rows<<" Columns: "<<metadata_columns<<" Edges: "<<metadata_edges<<endl;
 
 	cout<<"- Allocating CSR representation memory..."<<endl;
 
 	// Allocating CSR memory
-	edges = (int *) malloc(metadata_edges * sizeof(int));
-	values = (double *) malloc(metadata_edges * sizeof(double));
-	vertices = (int  *) malloc((metadata_rows + 1) * sizeof(int));
+	edges = (int *) numa_malloc(metadata_edges * sizeof(int));
+	values = (double *) numa_malloc(metadata_edges * sizeof(double));
+	vertices = (int  *) numa_malloc((metadata_rows + 1) * sizeof(int));
+
+	cout<<"- Parsing sections..."<<endl;
+
+	// Each section in parallel chunks
+	if (parse_csr_section(&text, text.vertices_begin, text.vertices_end, vertices, metadata_rows + 1) < 0 ||
+	    parse_csr_section(&text, text.edges_begin, text.edges_end, edges, metadata_edges) < 0 ||
+	    parse_csr_section(&text, text.values_begin, text.values_end, values, metadata_edges) < 0) {
+		cerr<<"Malformed CSR matrix: a section's entry count does not match the metadata line."<<endl;
+		exit(1);
+	}
 
-	cout<<"- Reading vertices..."<<endl;
+	release_csr_text(&text);
+}
 
-	// Read VERTICES preamble
-	getline(cin,serialized_data);
-        assert(strcmp(serialized_data.c_str(),"VERTICES") == 0);
+/*
 
-	// Read vertices until we hit EDGES preamble
-	int i=0;
-	//cout<<"metadata_rows: "<<metadata_rows<<endl;
-	while (getline(cin,serialized_data) && strcmp(serialized_data.c_str(),"EDGES") != 0) {
- 		assert(i < (metadata_rows+1));
-		int vertex_edge_edx = 0;
-		sscanf(serialized_data.c_str(), "%d", &vertex_edge_edx);
-		vertices[i] = vertex_edge_edx;
-		i++;
-	}
+Sort every row's columns and coalesce repeated ones (see csr_normalize.h),
+which the intersection kernels and the column index rely on. Rows that are
+already strictly increasing cost one check; only if columns were coalesced
+are the arrays compacted into new ones, placed like the originals.
 
-	// Read edges until we hit VALUES preamble
-	i=0;
-	while (getline(cin,serialized_data) && strcmp(serialized_data.c_str(),"VALUES") != 0) {
-		assert(i < metadata_edges);
-		int edge_destination_vertex = 0;
-		sscanf(serialized_data.c_str(), "%d", &edge_destination_vertex);
-		edges[i] = edge_destination_vertex;
-		i++;
-	}
+*/
+void normalize_csr() {
+
+	vector<int> degrees(metadata_rows);
+	long long int rows_sorted = 0;
+	long long int kept = sort_csr_rows(metadata_rows, vertices, edges, values, degrees.data(), normalize_grain, &rows_sorted);
 
-	// Read values until EOF
-	i=0;
-	while (getline(cin,serialized_data)) {
-		assert(i < metadata_edges);
-		double value = 0;
-		sscanf(serialized_data.c_str(), "%lf", &value);
-		values[i] = value;
-		i++;
+	if (kept < metadata_edges) {
+		int* normal_vertices = (int *) numa_malloc((metadata_rows + 1) * sizeof(int));
+		int* normal_edges = (int *) numa_malloc(kept * sizeof(int));
+		double* normal_values = (double *) numa_malloc(kept * sizeof(double));
+		compact_csr_rows(metadata_rows, vertices, edges, values, degrees.data(), normalize_grain, normal_vertices, normal_edges, normal_values);
+
+		if (csr_in_place) {
+			release_csr_text(&csr_input);
+			csr_in_place = false;
+		} else {
+			free(vertices);
+			free(edges);
+			free(values);
+		}
+		vertices = normal_vertices;
+		edges = normal_edges;
+		values = normal_values;
 	}
+
+	cout<<"- Normalized: "<<rows_sorted<<" rows sorted, "<<(metadata_edges - kept)<<" repeated nonzeros coalesced"<<endl;
+	metadata_edges = kept;
+}
+
+/*
+
+With -M, print the NUMA placement of the CSR arrays, the column index when
+built, and each engine's affinity array before it is freed
+
+*/
+void report_placement() {
+	if (!placement_report) return;
+	numa_report("vertices", vertices, (metadata_rows + 1) * sizeof(int));
+	numa_report("edges", edges, metadata_edges * sizeof(int));
+	numa_report("values", values, metadata_edges * sizeof(double));
+	numa_report("col_vertices", col_vertices, col_vertices ? (metadata_columns + 1) * sizeof(int) : 0);
+	numa_report("col_rows", col_rows, col_rows ? metadata_edges * sizeof(int) : 0);
+}
+
+void report_affinity_placement(long long int* affinity_array) {
+	if (placement_report) numa_report("affinity_array", affinity_array, metadata_rows * sizeof(long long int));
 }
 
 /*
@@ -176,6 +413,124 @@ void print_csr() {
 
 }
 
+/*
+
+Build the inverted column index from the CSR representation
+
+Two-pass counting sort over edges: histogram the columns, prefix-sum into
+col_vertices, then scatter each row id into its columns. Rows are visited in
+ascending order, so every column's row list comes out sorted. A row repeating
+a column is only recorded once, matching the once-per-row match in the
+original scan loops.
+
+*/
+void build_column_index() {
+
+	col_vertices = (int *) numa_calloc(metadata_columns + 1, sizeof(int));
+	col_rows = (int *) numa_malloc(metadata_edges * sizeof(int));
+	int *col_last_row = (int *) malloc(metadata_columns * sizeof(int));
+
+	// Histogram the columns into col_vertices[c+1]
+	for (int c=0; c<metadata_columns; c++) col_last_row[c] = -1;
+	for (int r=0; r<metadata_rows; r++) {
+		for (int e=vertices[r]; e<vertices[r+1]; e++) {
+			int c = edges[e];
+			if (col_last_row[c] != r) {
+				col_last_row[c] = r;
+				col_vertices[c+1]++;
+			}
+		}
+	}
+
+	// Prefix-sum
+	for (int c=0; c<metadata_columns; c++) col_vertices[c+1] += col_vertices[c];
+
+	// Scatter rows into their columns
+	int *col_fill = (int *) malloc(metadata_columns * sizeof(int));
+	for (int c=0; c<metadata_columns; c++) {
+		col_fill[c] = col_vertices[c];
+		col_last_row[c] = -1;
+	}
+	for (int r=0; r<metadata_rows; r++) {
+		for (int e=vertices[r]; e<vertices[r+1]; e++) {
+			int c = edges[e];
+			if (col_last_row[c] != r) {
+				col_last_row[c] = r;
+				col_rows[col_fill[c]++] = r;
+			}
+		}
+	}
+
+	free(col_fill);
+	free(col_last_row);
+}
+
+/*
+
+Set col_stride for every column from hub_degree and hub_mode
+
+Returns the number of hub columns.
+
+*/
+int cap_hub_columns() {
+	if (col_stride == NULL) col_stride = (int *) malloc(metadata_columns * sizeof(int));
+
+	int hubs = 0;
+	for (int c=0; c<metadata_columns; c++) {
+		int degree = col_vertices[c+1] - col_vertices[c];
+		col_stride[c] = 1;
+		if (hub_degree > 0 && degree > hub_degree) {
+			hubs++;
+			// Sample roughly hub_degree rows of the column
+			col_stride[c] = (hub_mode == HUB_SKIP) ? 0 : (degree + hub_degree - 1) / hub_degree;
+		}
+	}
+
+	return hubs;
+}
+
+/*
+
+Column degree above which the top pct percent of columns lie
+
+*/
+int hub_percentile_degree(double pct) {
+	vector<int> degrees(metadata_columns);
+	for (int c=0; c<metadata_columns; c++) degrees[c] = col_vertices[c+1] - col_vertices[c];
+
+	int rank = (int)(metadata_columns * pct / 100.0);
+	if (rank <= 0 || metadata_columns == 0) return 0;
+	if (rank >= metadata_columns) rank = metadata_columns - 1;
+
+	nth_element(degrees.begin(), degrees.begin() + rank, degrees.end(), greater<int>());
+	return degrees[rank] > 0 ? degrees[rank] : 1;
+}
+
+/*
+
+Reuse quality of the current permutation: the sum over every placed row of
+its exact affinity with the window of rows placed before it, i.e. the
+objective the greedy maximizes step by step.
+
+*/
+long long int window_affinity() {
+	vector<int> window_columns(metadata_columns, 0); // Window rows holding each column
+	long long int total = 0;
+
+	for (int r_permutation=0; r_permutation<metadata_rows; r_permutation++) {
+		int r_coord = permutation[r_permutation];
+		for (int e=vertices[r_coord]; e<vertices[r_coord+1]; e++) total += window_columns[edges[e]];
+
+		for (int e=vertices[r_coord]; e<vertices[r_coord+1]; e++) window_columns[edges[e]]++;
+		if (r_permutation >= window) {
+			int r_evict = permutation[r_permutation - window];
+			for (int e=vertices[r_evict]; e<vertices[r_evict+1]; e++) window_columns[edges[e]]--;
+		}
+	}
+
+	return total;
+}
+
 // Affinity queue implementation
 
 typedef struct pq_item {
@@ -435,109 +790,1089 @@ void parallel_row_reorder()
 
 long long int parallel_row_intersection(int row_0_idx, int row_1_idx);
 
-void parallel_row_reorder()
+/*
+
+Allocate one scratch arena per worker slot
+
+*/
+void init_spa_arenas(int slots) {
+	spa_arenas.resize(slots);
+	for (int s=0; s<slots; s++) {
+		spa_arenas[s].epoch = 0;
+		spa_arenas[s].touched_count = 0;
+		spa_arenas[s].column_epoch.assign(metadata_columns, 0);
+		spa_arenas[s].touched_rows.assign(metadata_rows, 0);
+		spa_arenas[s].row_round.assign(metadata_rows, 0);
+	}
+}
+
+/*
+
+Start a new pass in the arena: clear its marks and touched rows, then mark
+the columns of row
+
+*/
+void spa_mark_row(spa_arena* arena, int row) {
+	arena->epoch++;
+	arena->touched_count = 0;
+	for (int e=vertices[row]; e<vertices[row+1]; e++) arena->column_epoch[edges[e]] = arena->epoch;
+}
+
+/*
+
+Columns the nonzeros e_begin .. e_end-1 of row_1 share with the marked
+row_0. Two dense rows AND their bitmaps instead, counted whole by the slice
+starting the row and not at all by the others; anything else probes the
+marks once per nonzero.
+
+*/
+long long int spa_row_intersection(spa_arena* arena, int row_0_idx, int row_1_idx, int e_begin, int e_end) {
+	int slot_0 = bitmaps.bitmap_slot[row_0_idx], slot_1 = bitmaps.bitmap_slot[row_1_idx];
+	if (slot_0 >= 0 && slot_1 >= 0) {
+		if (e_begin != vertices[row_1_idx]) return 0;
+		return intersect_bitmaps(&bitmaps.bits[((size_t)slot_0) * bitmaps.words], &bitmaps.bits[((size_t)slot_1) * bitmaps.words], bitmaps.words);
+	}
+
+	long long int count = 0;
+	for (int e=e_begin; e<e_end; e++) count += arena->column_epoch[edges[e]] == arena->epoch;
+	return count;
+}
+
+long long int parallel_row_reorder()
 {
         auto t1 = high_resolution_clock::now();
 
 	int reordered_row = 0;
 
  
-        long long int* affinity_array = (long long int *) calloc(metadata_rows, sizeof(long long int));; // affinity array for row affinities
+        long long int* affinity_array = (long long int *) numa_calloc(metadata_rows, sizeof(long long int)); // affinity array for row affinities
         permutation = (int  *) malloc(metadata_rows * sizeof(int));
 
         // Seed the permutation with the first row
         permutation[0] = 0;
         affinity_array[0] = (long long int)-1;
 
-        // Algorithm tuning parameter
-        int window = 10;
+	tournament_tree max_affinity_tree;
+	build_tournament_tree(&max_affinity_tree, affinity_array, metadata_rows);
+	init_spa_arenas(1);
+	spa_arena* arena = &spa_arenas[0];
 
         for (int r_permutation=1; r_permutation<metadata_rows; r_permutation++) {
-		cilk::reducer_max_index<int,int>  max_affinity_row;
-		cilk::reducer_opadd<long long int> sum;
-
-
-		for (int i=0; i < metadata_rows; i++) {
+		// One SPA pass: mark the last reordered row, probe every candidate in
+		// edge-balanced slices, so long rows are split and their counts merged
+		spa_mark_row(arena, permutation[r_permutation-1]);
+		parallel_for_edges(vertices, metadata_rows, intersect_grain, [&](int i, int e_begin, int e_end) {
 			if (affinity_array[i] != (long long int)-1) {
-				affinity_array[i] += parallel_row_intersection(permutation[r_permutation-1], i);
+				long long int shared = spa_row_intersection(arena, permutation[r_permutation-1], i, e_begin, e_end);
+				if (shared == 0) return;
+				if (e_begin == vertices[i] && e_end == vertices[i+1]) {
+					affinity_array[i] += shared;
+				} else {
+					// Slices of a split row merge, and the first to count lists the row
+					__atomic_fetch_add(&affinity_array[i], shared, __ATOMIC_RELAXED);
+					if (__atomic_exchange_n(&arena->row_round[i], r_permutation, __ATOMIC_RELAXED) == r_permutation) return;
+				}
+				arena->touched_rows[__atomic_fetch_add(&arena->touched_count, 1, __ATOMIC_RELAXED)] = i;
 			}
-		}
+		});
 
 		// Find max-affinity row
-		cilk_for (int i=0; i < metadata_rows; i++)
-			if (affinity_array[i] != (long long int)-1)
-				max_affinity_row.calc_max(max_affinity_row, affinity_array[i]);
-
-		reordered_row = max_affinity_row.get_index();
+		tournament_update_batch(&max_affinity_tree, arena->touched_rows.data(), arena->touched_count);
+		reordered_row = tournament_top(&max_affinity_tree);
 		cout<<"- reordered_row: "<<reordered_row<<" affinity: "<<affinity_array[reordered_row]<<endl;
 		permutation[r_permutation] = reordered_row;
 		affinity_array[reordered_row] = (long long int)-1;
+		tournament_update(&max_affinity_tree, reordered_row);
 	}
 
         auto t2 = high_resolution_clock::now();
 
         auto ms_int = duration_cast<milliseconds>(t2-t1);
 
-        cout<< ms_int.count() << endl;
+	report_affinity_placement(affinity_array);
+	free(affinity_array);
+
+	return ms_int.count();
+}
+
+
+/*
+
+Column-driven parallel affinity scatter
+
+Instead of intersecting the placed row with every row, walk the placed row's
+columns and scatter +1 to every un-reordered row listed under each column in
+the inverted column index; the row leaving the window scatters -1 the same
+way. Work per step is proportional to the actual overlap, and both the
+column loop and each column's row list are parallel loops, with the affinity
+counters updated atomically.
+
+*/
+void scatter_row_affinity(int row, long long int delta, long long int* affinity_array) {
+	int edge_offset = vertices[row];
+	int payload_length = vertices[row+1] - vertices[row];
+	parallel_for(0, payload_length, [&](int c_pos) {
+		int c_coord = edges[edge_offset+c_pos];
+		int stride = col_stride[c_coord];
+		if (stride == 0) return;
+		int first = col_vertices[c_coord];
+		parallel_for(0, (col_vertices[c_coord+1] - first + stride - 1) / stride, [&](int k) {
+			int r_coord = col_rows[first + k*stride];
+			// Reordered rows are only marked between scatters, so this check cannot race
+			if (affinity_array[r_coord] != (long long int)-1)
+				__atomic_fetch_add(&affinity_array[r_coord], delta, __ATOMIC_RELAXED);
+		});
+	});
+}
+
+/*
+
+Scatter as scatter_row_affinity(), also appending to touched every slot
+(row >> shift, so a row or a block of rows) whose affinities change, once
+per round via the touched_round stamps
+
+*/
+void scatter_tracked_row_affinity(int row, long long int delta, long long int* affinity_array, int shift,
+                                  int round, int* touched_round, int* touched, int* touched_count) {
+	int edge_offset = vertices[row];
+	int payload_length = vertices[row+1] - vertices[row];
+	parallel_for(0, payload_length, [&](int c_pos) {
+		int c_coord = edges[edge_offset+c_pos];
+		int stride = col_stride[c_coord];
+		if (stride == 0) return;
+		int first = col_vertices[c_coord];
+		parallel_for(0, (col_vertices[c_coord+1] - first + stride - 1) / stride, [&](int k) {
+			int r_coord = col_rows[first + k*stride];
+			// Rows may be claimed concurrently (see multiqueue_row_reorder()), so
+			// never update one whose affinity is already -1
+			long long int affinity = __atomic_load_n(&affinity_array[r_coord], __ATOMIC_RELAXED);
+			while (affinity != (long long int)-1 &&
+			       !__atomic_compare_exchange_n(&affinity_array[r_coord], &affinity, affinity + delta, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+			if (affinity != (long long int)-1) {
+				// Test before exchanging: slots are mostly touched again within a round
+				int slot = r_coord >> shift;
+				if (__atomic_load_n(&touched_round[slot], __ATOMIC_RELAXED) != round &&
+				    __atomic_exchange_n(&touched_round[slot], round, __ATOMIC_RELAXED) != round)
+					touched[__atomic_fetch_add(touched_count, 1, __ATOMIC_RELAXED)] = slot;
+			}
+		});
+	});
+}
+
+long long int parallel_scatter_row_reorder()
+{
+        auto t1 = high_resolution_clock::now();
+
+	int reordered_row = 0;
+
+        long long int* affinity_array = (long long int *) numa_calloc(metadata_rows, sizeof(long long int)); // affinity array for row affinities
+        permutation = (int  *) malloc(metadata_rows * sizeof(int));
 
+        // Seed the permutation with the first row
+        permutation[0] = 0;
+        affinity_array[0] = (long long int)-1;
+
+	tournament_tree max_affinity_tree;
+	build_tournament_tree(&max_affinity_tree, affinity_array, metadata_rows);
+	// Changed leaf blocks of the tree
+	int blocks = (metadata_rows + TOURNAMENT_BLOCK - 1) / TOURNAMENT_BLOCK;
+	int* touched_round = (int *) calloc(blocks, sizeof(int));
+	int* touched = (int *) malloc(blocks * sizeof(int));
+
+        for (int r_permutation=1; r_permutation<metadata_rows; r_permutation++) {
+		int touched_count = 0;
+
+		// Rows entering and leaving the window
+		scatter_tracked_row_affinity(permutation[r_permutation-1], 1, affinity_array, TOURNAMENT_BLOCK_SHIFT,
+		                             r_permutation, touched_round, touched, &touched_count);
+		if (r_permutation > window)
+			scatter_tracked_row_affinity(permutation[r_permutation-window-1], -1, affinity_array, TOURNAMENT_BLOCK_SHIFT,
+			                             r_permutation, touched_round, touched, &touched_count);
+
+		// Find max-affinity row
+		tournament_update_blocks(&max_affinity_tree, touched, touched_count);
+		reordered_row = tournament_top(&max_affinity_tree);
+		permutation[r_permutation] = reordered_row;
+		affinity_array[reordered_row] = (long long int)-1;
+		tournament_update(&max_affinity_tree, reordered_row);
+	}
+
+	free(touched);
+	free(touched_round);
+
+        auto t2 = high_resolution_clock::now();
+
+        auto ms_int = duration_cast<milliseconds>(t2-t1);
+
+	report_affinity_placement(affinity_array);
 	free(affinity_array);
 
+	return ms_int.count();
 }
 
+/*
 
-void print_permutation() {
-	cout<<"Printing row permuation."<<endl<<endl;
-	for (int i=0; i<metadata_rows; i++)  cout<<permutation[i]<<" ";
-	cout<<endl;
+MinHash/LSH approximate reordering
+
+Rows are only compared with rows sharing an LSH chunk in some band, and
+affinity is the number of agreeing signature entries, i.e. the estimated
+Jaccard similarity scaled by the signature length. The greedy keeps the
+window semantics of the exact engines: a placed row adds its estimated
+similarity to its candidates and the row leaving the window takes it back.
+
+*/
+unsigned long long int splitmix64(unsigned long long int x) {
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
 }
 
-void free_all() {
-	free(vertices);
-	free(edges);
-	free(values);
-	free(permutation);
+/*
+
+Compute every row's MinHash signature in parallel, deriving the k hash
+functions of a column from one 64-bit hash (h1 + i*h2)
+
+*/
+void build_minhash_signatures() {
+	int k = minhash_bands * minhash_band_rows;
+	signatures = (unsigned int *) malloc(((size_t)metadata_rows) * k * sizeof(unsigned int));
+	parallel_for((size_t)0, ((size_t)metadata_rows) * k, [&](size_t i) { signatures[i] = 0xffffffffU; });
+
+	// Edge-balanced slices; a row split across slices merges its partial
+	// minima with an atomic min
+	parallel_for_edges(vertices, metadata_rows, minhash_grain, [&](int r, int e_begin, int e_end) {
+		unsigned int* signature = &signatures[((size_t)r) * k];
+		bool whole_row = e_begin == vertices[r] && e_end == vertices[r+1];
+		vector<unsigned int> partial;
+		unsigned int* slice = signature;
+		if (!whole_row) {
+			partial.assign(k, 0xffffffffU);
+			slice = partial.data();
+		}
+
+		for (int e=e_begin; e<e_end; e++) {
+			unsigned long long int h = splitmix64((unsigned long long int)edges[e]);
+			unsigned int h1 = (unsigned int)h, h2 = ((unsigned int)(h >> 32)) | 1;
+			for (int i=0; i<k; i++) {
+				unsigned int hi = h1 + i*h2;
+				if (hi < slice[i]) slice[i] = hi;
+			}
+		}
+
+		if (whole_row) return;
+		for (int i=0; i<k; i++) {
+			unsigned int current = __atomic_load_n(&signature[i], __ATOMIC_RELAXED);
+			while (slice[i] < current && !__atomic_compare_exchange_n(&signature[i], &current, slice[i], true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+		}
+	});
 }
-long long int parallel_row_intersection(int row_0_idx, int row_1_idx){
+
+/*
+
+Bucket rows by band in parallel and split the buckets into capped chunks
+
+*/
+void build_lsh_chunks() {
+	int k = minhash_bands * minhash_band_rows;
+	row_chunks = (int *) malloc(((size_t)minhash_bands) * metadata_rows * sizeof(int));
+
+	vector< vector<int> > band_offsets(minhash_bands), band_rows(minhash_bands);
+
+	parallel_for(0, minhash_bands, [&](int b) {
+		// Key every non-empty row by a hash of its band
+		vector< pair<unsigned long long int, int> > keys;
+		for (int r=0; r<metadata_rows; r++) {
+			if (vertices[r+1] == vertices[r]) continue;
+			unsigned long long int key = b;
+			for (int i=0; i<minhash_band_rows; i++) key = splitmix64(key ^ signatures[((size_t)r) * k + b*minhash_band_rows + i]);
+			keys.push_back(make_pair(key, r));
+		}
+		sort(keys.begin(), keys.end());
+
+		for (int r=0; r<metadata_rows; r++) row_chunks[((size_t)b) * metadata_rows + r] = -1;
+
+		// Cut runs of equal keys into chunks of at most MINHASH_BUCKET_CAP rows
+		size_t run_start = 0;
+		while (run_start < keys.size()) {
+			size_t run_end = run_start;
+			while (run_end < keys.size() && keys[run_end].first == keys[run_start].first) run_end++;
+
+			for (size_t chunk_start=run_start; chunk_start<run_end; chunk_start+=MINHASH_BUCKET_CAP) {
+				size_t chunk_end = (chunk_start + MINHASH_BUCKET_CAP < run_end) ? chunk_start + MINHASH_BUCKET_CAP : run_end;
+				if (chunk_end - chunk_start < 2) continue;
+				for (size_t i=chunk_start; i<chunk_end; i++) {
+					row_chunks[((size_t)b) * metadata_rows + keys[i].second] = band_offsets[b].size();
+					band_rows[b].push_back(keys[i].second);
+				}
+				band_offsets[b].push_back(band_rows[b].size());
+			}
+			run_start = run_end;
+		}
+	});
+
+	// Concatenate the bands, rebasing their chunk ids
+	chunk_offsets.assign(1, 0);
+	chunk_rows.clear();
+	for (int b=0; b<minhash_bands; b++) {
+		int chunk_base = chunk_offsets.size() - 1;
+		int row_base = chunk_rows.size();
+		for (int r=0; r<metadata_rows; r++)
+			if (row_chunks[((size_t)b) * metadata_rows + r] >= 0) row_chunks[((size_t)b) * metadata_rows + r] += chunk_base;
+		for (size_t i=0; i<band_offsets[b].size(); i++) chunk_offsets.push_back(row_base + band_offsets[b][i]);
+		chunk_rows.insert(chunk_rows.end(), band_rows[b].begin(), band_rows[b].end());
+	}
+}
+
+/*
+
+Add delta times the estimated similarity of row to each of its un-reordered
+LSH candidates, pushing raised affinities onto the (lazy) max-heap
+
+*/
+void scatter_minhash_affinity(int row, int delta, int stamp, vector<int>* affinity, vector<int>* visited,
+                              priority_queue< pair<int, int> >* candidates) {
+	vector<int>& affinityRef = *affinity;
+	vector<int>& visitedRef = *visited;
+	int k = minhash_bands * minhash_band_rows;
+	const unsigned int* signature_0 = &signatures[((size_t)row) * k];
+
+	for (int b=0; b<minhash_bands; b++) {
+		int chunk = row_chunks[((size_t)b) * metadata_rows + row];
+		if (chunk < 0) continue;
+
+		for (int pos=chunk_offsets[chunk]; pos<chunk_offsets[chunk+1]; pos++) {
+			int r1_coord = chunk_rows[pos];
+			// Candidates found through several bands are only counted once
+			if (r1_coord == row || affinityRef[r1_coord] == -1 || visitedRef[r1_coord] == stamp) continue;
+			visitedRef[r1_coord] = stamp;
+
+			const unsigned int* signature_1 = &signatures[((size_t)r1_coord) * k];
+			int matches = 0;
+			for (int i=0; i<k; i++) matches += (signature_0[i] == signature_1[i]);
+			if (matches == 0) continue;
+
+			affinityRef[r1_coord] += delta * matches;
+			if (delta > 0) candidates->push(make_pair(affinityRef[r1_coord], r1_coord));
+		}
+	}
+}
+
+long long int minhash_row_reorder()
+{
         auto t1 = high_resolution_clock::now();
 
-	int* intersection_vector = (int*)calloc(metadata_columns, sizeof(int));
-	cilk::reducer_opadd<long long int> sum;
-
-	long long int row_0_edge_count = vertices[row_0_idx+1] - vertices[row_0_idx];
-	cout<<"row_0_edge_count: "<<row_0_edge_count<<endl;
-	long long int row_1_edge_count = vertices[row_1_idx+1] - vertices[row_1_idx];
-        cout<<"row_1_edge_count: "<<row_1_edge_count<<endl;
-        long long int total_edge_combinations = row_0_edge_count*row_1_edge_count;
-	cout<<"total_edge_combinations: "<<total_edge_combinations<<endl;
-	cilk_for (long long int r=0; r<total_edge_combinations; r++) {
-		long long int r0_pos = r % row_0_edge_count + ((long long int)vertices[row_0_idx]);
-		long long int r1_pos = ((long long int)r/row_0_edge_count) + ((long long int)vertices[row_1_idx]);
-		long long int r0_coord = edges[r0_pos];
-		long long int r1_coord = edges[r1_pos];
-		
-		if (r0_coord == r1_coord) {
-			*sum += 1;
+	build_minhash_signatures();
+	build_lsh_chunks();
+
+	vector<int> affinity(metadata_rows, 0); // Estimated affinities, -1 once reordered
+	vector<int> visited(metadata_rows, -1); // Last scatter that reached each row
+	priority_queue< pair<int, int> > candidates; // (affinity, row), possibly stale
+	int next_unplaced = 0; // Fallback when no candidate has positive affinity
+
+        permutation = (int  *) malloc(metadata_rows * sizeof(int));
+
+        // Seed the permutation with the first row
+        permutation[0] = 0;
+        affinity[0] = -1;
+
+        for (int r_permutation=1; r_permutation<metadata_rows; r_permutation++) {
+
+		// Rows entering and leaving the window
+		scatter_minhash_affinity(permutation[r_permutation-1], 1, 2*r_permutation, &affinity, &visited, &candidates);
+		if (r_permutation > window)
+			scatter_minhash_affinity(permutation[r_permutation-window-1], -1, 2*r_permutation+1, &affinity, &visited, &candidates);
+
+		// Pop until the top entry matches its row's current affinity. Every
+		// candidate keeps an entry at least as high as its affinity, so a
+		// matching top is a max-affinity candidate.
+		int reordered_row = -1;
+		while (!candidates.empty()) {
+			pair<int, int> top = candidates.top();
+			candidates.pop();
+			int current = affinity[top.second];
+			if (current == top.first && current > 0) {
+				reordered_row = top.second;
+				break;
+			}
+			// Stale-high entry: replace it with the current affinity
+			if (current > 0 && current < top.first) candidates.push(make_pair(current, top.second));
 		}
+
+		if (reordered_row < 0) {
+			while (affinity[next_unplaced] == -1) next_unplaced++;
+			reordered_row = next_unplaced;
+		}
+
+		permutation[r_permutation] = reordered_row;
+		affinity[reordered_row] = -1;
 	}
-	cilk_sync;
 
-	return sum.get_value();
+        auto t2 = high_resolution_clock::now();
+
+        auto ms_int = duration_cast<milliseconds>(t2-t1);
+
+	return ms_int.count();
+}
 
 /*
-	cout<<"intersection_vector: [ ");
-	for (int i=0; i<metadata_columns; i++) {
-		cout<<"%d ", intersection_vector[i]);
+
+Speculative top-k parallel greedy
+
+Each round takes the top k+1 un-reordered rows in one parallel scan, then
+keeps placing rows without rescanning for as long as it can prove the choice
+is the one the sequential greedy would make. Every scatter records the rows
+it touches. The next row is the best among the untouched top-k entries and
+the touched rows, compared on rank_key(). Rows outside the scan and
+untouched still hold their round-start affinity, which ranks below the
+(k+1)-th key, so a best that beats that key is exact. Otherwise the round
+stops and the top-k scan is redone. The result matches the sequential
+greedy with ties broken towards the lower row, for any k; k only trades
+scan cost against wasted speculation.
+
+With speculation_relaxed, a round instead commits its top-k rows in scan
+order with no validation: fewer scans, no longer the exact greedy.
+
+*/
+// Order rows by affinity, then lower row id; -1 for reordered rows
+inline long long int rank_key(long long int* affinity_array, int row) {
+	if (affinity_array[row] == (long long int)-1) return -1;
+	return (affinity_array[row] << 32) | (long long int)(0xffffffffU - (unsigned int)row);
+}
+
+inline int rank_key_row(long long int key) {
+	return (int)(0xffffffffU - (unsigned int)(key & 0xffffffffLL));
+}
+
+/*
+
+Top count rank keys, in descending order, by blocked parallel scan into
+the reused block_top scratch
+
+*/
+void top_rank_keys(long long int* affinity_array, int count, vector<long long int>* block_top_scratch, vector<long long int>* top) {
+	int blocks = (metadata_rows + speculation_grain - 1) / speculation_grain;
+	vector<long long int>& block_top = *block_top_scratch;
+	block_top.assign(((size_t)blocks) * count, -1);
+
+	parallel_for(0, blocks, [&](int b) {
+		long long int* best = &block_top[((size_t)b) * count];
+		int end = ((b+1)*speculation_grain < metadata_rows) ? (b+1)*speculation_grain : metadata_rows;
+		for (int i=b*speculation_grain; i<end; i++) {
+			long long int key = rank_key(affinity_array, i);
+			if (key <= best[count-1]) continue;
+			int pos = count-1;
+			while (pos > 0 && best[pos-1] < key) {
+				best[pos] = best[pos-1];
+				pos--;
+			}
+			best[pos] = key;
+		}
+	});
+
+	top->clear();
+	for (size_t i=0; i<block_top.size(); i++) if (block_top[i] >= 0) top->push_back(block_top[i]);
+	int keep = ((int)top->size() < count) ? (int)top->size() : count;
+	partial_sort(top->begin(), top->begin() + keep, top->end(), greater<long long int>());
+	top->resize(keep);
+}
+
+/*
+
+Best rank key among the touched rows, by blocked parallel max into the
+reused block_best scratch
+
+*/
+long long int best_touched_key(long long int* affinity_array, int* touched, int touched_count, vector<long long int>* block_best_scratch) {
+	int blocks = (touched_count + speculation_grain - 1) / speculation_grain;
+	vector<long long int>& block_best = *block_best_scratch;
+	block_best.assign(blocks, -1);
+
+	parallel_for(0, blocks, [&](int b) {
+		int end = ((b+1)*speculation_grain < touched_count) ? (b+1)*speculation_grain : touched_count;
+		for (int i=b*speculation_grain; i<end; i++) {
+			long long int key = rank_key(affinity_array, touched[i]);
+			if (key > block_best[b]) block_best[b] = key;
+		}
+	});
+
+	long long int best = -1;
+	for (int b=0; b<blocks; b++) if (block_best[b] > best) best = block_best[b];
+	return best;
+}
+
+long long int speculative_row_reorder()
+{
+        auto t1 = high_resolution_clock::now();
+
+        long long int* affinity_array = (long long int *) numa_calloc(metadata_rows, sizeof(long long int)); // affinity array for row affinities
+	init_spa_arenas(1);
+	spa_arena* arena = &spa_arenas[0];
+	int* touched_round = arena->row_round.data();
+	int blocks = (metadata_rows + speculation_grain - 1) / speculation_grain;
+	vector<long long int> top, block_top, block_best;
+	top.reserve(((size_t)blocks) * (speculation_k + 1));
+	block_top.reserve(((size_t)blocks) * (speculation_k + 1));
+	block_best.reserve(blocks);
+	long long int rounds = 0;
+
+        permutation = (int  *) malloc(metadata_rows * sizeof(int));
+
+        // Seed the permutation with the first row
+        permutation[0] = 0;
+        affinity_array[0] = (long long int)-1;
+	scatter_row_affinity(0, 1, affinity_array);
+
+	int r_permutation = 1;
+	while (r_permutation < metadata_rows) {
+		rounds++;
+		int round = (int)rounds;
+		arena->touched_count = 0;
+		top_rank_keys(affinity_array, speculation_k + 1, &block_top, &top);
+
+		// Without k+1 un-reordered rows the scan saw them all, so nothing bounds the choice
+		long long int threshold = ((int)top.size() > speculation_k) ? top[speculation_k] : -1;
+
+		for (int step=0; step<speculation_k && r_permutation<metadata_rows; step++) {
+			long long int best = -1;
+
+			if (speculation_relaxed) {
+				if (step < (int)top.size()) best = top[step];
+			} else {
+				// Best untouched top entry, then best touched row
+				for (size_t i=0; i<top.size(); i++) {
+					int row = rank_key_row(top[i]);
+					if (affinity_array[row] != (long long int)-1 && touched_round[row] != round) {
+						best = top[i];
+						break;
+					}
+				}
+				long long int touched_best = best_touched_key(affinity_array, arena->touched_rows.data(), arena->touched_count, &block_best);
+				if (touched_best > best) best = touched_best;
+
+				// A row outside the scan might win: stop speculating
+				if (best < threshold) break;
+			}
+			if (best < 0) break;
+
+			int reordered_row = rank_key_row(best);
+			permutation[r_permutation] = reordered_row;
+			affinity_array[reordered_row] = (long long int)-1;
+
+			// Rows entering and leaving the window
+			scatter_tracked_row_affinity(reordered_row, 1, affinity_array, 0, round, touched_round, arena->touched_rows.data(), &arena->touched_count);
+			if (r_permutation >= window)
+				scatter_tracked_row_affinity(permutation[r_permutation-window], -1, affinity_array, 0, round, touched_round,
+				                             arena->touched_rows.data(), &arena->touched_count);
+			r_permutation++;
+		}
 	}
-	cout<<"]\n");
+
+        auto t2 = high_resolution_clock::now();
+
+        auto ms_int = duration_cast<milliseconds>(t2-t1);
+
+	cout<<"Speculation rounds: "<<rounds<<" for "<<metadata_rows-1<<" steps"<<endl;
+
+	report_affinity_placement(affinity_array);
+	free(affinity_array);
+
+	return ms_int.count();
+}
+
+/*
+
+Connected-component decomposition
+
+Rows that share no columns, directly or transitively, never affect each
+other's affinity, so each component of the row-column bipartite graph can
+be reordered on its own and the results concatenated.
+
+Components are found with a lock-free union-find over rows (nodes
+0 .. metadata_rows-1) and columns (nodes metadata_rows ..): unions link the
+larger root under the smaller with a compare-and-swap, and finds halve their
+path as they go. Every root is therefore the smallest node of its set, which
+for any non-empty component is its smallest row.
+
 */
+int find_component(int* parent, int x) {
+	while (true) {
+		int p = __atomic_load_n(&parent[x], __ATOMIC_RELAXED);
+		if (p == x) return x;
+		int gp = __atomic_load_n(&parent[p], __ATOMIC_RELAXED);
+		// Path halving; losing this race only costs a longer path
+		if (p != gp) __atomic_compare_exchange_n(&parent[x], &p, gp, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+		x = gp;
+	}
+}
+
+void union_components(int* parent, int a, int b) {
+	while (true) {
+		a = find_component(parent, a);
+		b = find_component(parent, b);
+		if (a == b) return;
+		if (a < b) swap(a, b);
+		int expected = a;
+		if (__atomic_compare_exchange_n(&parent[a], &expected, b, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return;
+	}
+}
+
+void build_components() {
+	int nodes = metadata_rows + metadata_columns;
+	int* parent = (int *) malloc(nodes * sizeof(int));
+	parallel_for(0, nodes, [&](int x) { parent[x] = x; });
+
+	parallel_for_edges(vertices, metadata_rows, union_grain, [&](int r, int e_begin, int e_end) {
+		for (int e=e_begin; e<e_end; e++) union_components(parent, r, metadata_rows + edges[e]);
+	});
+
+	// Label rows by root; roots are rows, so component ids can be assigned in row order
+	int* row_root = (int *) malloc(metadata_rows * sizeof(int));
+	parallel_for(0, metadata_rows, [&](int r) { row_root[r] = find_component(parent, r); });
+
+	int* root_component = parent; // Reuse: component id of each root row
+	components = 0;
+	for (int r=0; r<metadata_rows; r++) {
+		if (row_root[r] == r) root_component[r] = components++;
+	}
+
+	// Counting sort of the rows by component
+	component_offsets = (int *) calloc(components + 1, sizeof(int));
+	component_rows = (int *) malloc(metadata_rows * sizeof(int));
+	for (int r=0; r<metadata_rows; r++) component_offsets[root_component[row_root[r]] + 1]++;
+	for (int k=0; k<components; k++) component_offsets[k+1] += component_offsets[k];
+	int* component_fill = (int *) malloc(components * sizeof(int));
+	for (int k=0; k<components; k++) component_fill[k] = component_offsets[k];
+	for (int r=0; r<metadata_rows; r++) component_rows[component_fill[root_component[row_root[r]]]++] = r;
+
+	free(component_fill);
+	free(row_root);
+	free(parent);
+}
+
+/*
+
+Windowed greedy over one group of rows (a component or a partition), seeded
+with its smallest row, writing its order to permutation[group_offsets[k]]
+onward. Affinity updates go through the global column index; when
+group_of is given, rows of other groups are ignored, otherwise the column
+index must only link rows of the same group. Either way concurrent groups
+touch disjoint row_positions entries.
+
+*/
+void group_row_reorder(int* group_offsets, int* group_rows, int* group_of, int k, vector<int>* row_positions) {
+	int offset = group_offsets[k];
+	int size = group_offsets[k+1] - offset;
+	int* order = &permutation[offset];
+	vector<int>& row_positionsRef = *row_positions;
+
+	if (size == 0) return;
+	order[0] = group_rows[offset];
+	if (size == 1) return;
+
+	vector<pq_item> pq;
+	row_positionsRef[order[0]] = -1;
+	for (int i=1; i<size; i++) {
+		pq_item temp;
+		temp.row = group_rows[offset+i];
+		temp.affinity = 0;
+		pq.push_back(temp);
+		row_positionsRef[temp.row] = i-1;
+	}
+
+	for (int r_permutation=1; r_permutation<size; r_permutation++) {
+		// Rows entering (+1) and leaving (-1) the window
+		for (int side=0; side<2; side++) {
+			if (side == 1 && r_permutation <= window) break;
+			int r0_coord = (side == 0) ? order[r_permutation-1] : order[r_permutation-window-1];
+
+			for (int e=vertices[r0_coord]; e<vertices[r0_coord+1]; e++) {
+				int c0_coord = edges[e];
+				for (int r1_pos=col_vertices[c0_coord]; r1_pos<col_vertices[c0_coord+1]; r1_pos++) {
+					int r1_coord = col_rows[r1_pos];
+					if (group_of != NULL && group_of[r1_coord] != k) continue;
+					if (r1_coord != r0_coord && row_positionsRef[r1_coord] > -1) {
+						if (side == 0) increment_row_affinity(r1_coord, &pq, row_positions);
+						else decrement_row_affinity(r1_coord, &pq, row_positions);
+					}
+				}
+			}
+		}
+
+		order[r_permutation] = pop_row(&pq, row_positions).row;
+	}
+}
+
+long long int component_parallel_row_reorder()
+{
+        auto t1 = high_resolution_clock::now();
+
+	build_components();
+
+        permutation = (int  *) malloc(metadata_rows * sizeof(int));
+	vector<int> row_positions(metadata_rows, -1); // Heap positions, shared by the disjoint components
+
+	parallel_for(0, components, [&](int k) { group_row_reorder(component_offsets, component_rows, NULL, k, &row_positions); });
 
         auto t2 = high_resolution_clock::now();
 
         auto ms_int = duration_cast<milliseconds>(t2-t1);
 
-        cout<<"Intersection runtime: "<< ms_int.count() << endl;
+	return ms_int.count();
+}
+
+/*
+
+Partition-and-stitch
+
+Balanced label propagation splits the rows into partitions of similar
+rows: starting from MinHash-sorted blocks, every row repeatedly moves to the
+partition most of its column neighbours belong to (at most LP_NEIGHBOR_CAP
+sampled per column), unless that partition is full. Moves are applied in
+place, in parallel, with partition sizes kept by atomics.
+
+*/
+void build_partitions() {
+	partition_of = (int *) malloc(metadata_rows * sizeof(int));
+	vector<int> partition_size(partitions, 0);
+	int capacity = (int)((1.0 + PARTITION_IMBALANCE) * metadata_rows / partitions) + 1;
+
+	// Seed with contiguous blocks of the rows sorted by a one-hash MinHash key,
+	// which already places most rows sharing many columns together
+	vector<pair<unsigned long long int, int> > seed_order(metadata_rows);
+	parallel_for(0, metadata_rows, [&](int r) {
+		unsigned long long int key = ~0ULL;
+		for (int e=vertices[r]; e<vertices[r+1]; e++) key = min(key, splitmix64(edges[e]));
+		seed_order[r] = make_pair(key, r);
+	});
+	sort(seed_order.begin(), seed_order.end());
+	for (int i=0; i<metadata_rows; i++) {
+		partition_of[seed_order[i].second] = (int)(((long long int)i) * partitions / metadata_rows);
+		partition_size[partition_of[seed_order[i].second]]++;
+	}
+
+	// A row votes as a whole, so blocks are cut at row boundaries, by edge work
+	vector<int> blocks = edge_balanced_blocks(vertices, metadata_rows, lp_grain);
+	for (int it=0; it<LP_ITERATIONS; it++) {
+		int moves = 0;
+		parallel_for(0, (int)blocks.size() - 1, [&](int b) {
+			vector<int> votes(partitions, 0);
+			vector<int> voted;
+
+			for (int r=blocks[b]; r<blocks[b+1]; r++) {
+				for (int e=vertices[r]; e<vertices[r+1]; e++) {
+					int c = edges[e];
+					int degree = col_vertices[c+1] - col_vertices[c];
+					int stride = (degree > LP_NEIGHBOR_CAP) ? degree / LP_NEIGHBOR_CAP : 1;
+					for (int r1_pos=col_vertices[c]; r1_pos<col_vertices[c+1]; r1_pos+=stride) {
+						int r1 = col_rows[r1_pos];
+						if (r1 == r) continue;
+						int label = __atomic_load_n(&partition_of[r1], __ATOMIC_RELAXED);
+						if (votes[label]++ == 0) voted.push_back(label);
+					}
+				}
+
+				int current = partition_of[r];
+				int best = current;
+				for (size_t i=0; i<voted.size(); i++) {
+					if (votes[voted[i]] > votes[best] || (votes[voted[i]] == votes[best] && best != current && voted[i] < best)) best = voted[i];
+				}
+				for (size_t i=0; i<voted.size(); i++) votes[voted[i]] = 0;
+				voted.clear();
+
+				if (best == current) continue;
+				if (__atomic_add_fetch(&partition_size[best], 1, __ATOMIC_RELAXED) > capacity) {
+					__atomic_fetch_sub(&partition_size[best], 1, __ATOMIC_RELAXED);
+					continue;
+				}
+				__atomic_fetch_sub(&partition_size[current], 1, __ATOMIC_RELAXED);
+				__atomic_store_n(&partition_of[r], best, __ATOMIC_RELAXED);
+				__atomic_fetch_add(&moves, 1, __ATOMIC_RELAXED);
+			}
+		});
+		if (moves == 0) break;
+	}
 
-	cout<<"Sum: "<<sum.get_value()<<endl;
+	// Counting sort of the rows by partition
+	partition_offsets = (int *) calloc(partitions + 1, sizeof(int));
+	partition_rows = (int *) malloc(metadata_rows * sizeof(int));
+	for (int r=0; r<metadata_rows; r++) partition_offsets[partition_of[r] + 1]++;
+	for (int p=0; p<partitions; p++) partition_offsets[p+1] += partition_offsets[p];
+	vector<int> partition_fill(partition_offsets, partition_offsets + partitions);
+	for (int r=0; r<metadata_rows; r++) partition_rows[partition_fill[partition_of[r]]++] = r;
+}
+
+/*
+
+Affinity gained across a junction when segment b (of size_b rows) directly
+follows segment a: each of b's first window rows sees the last rows of a
+still in its window. segment_row() is the i-th row of a partition's
+reordered segment in the given orientation.
+
+*/
+inline int segment_row(int p, bool reversed, int i) {
+	int offset = partition_offsets[p];
+	int size = partition_offsets[p+1] - offset;
+	return permutation[reversed ? offset + size - 1 - i : offset + i];
+}
+
+long long int junction_affinity(int a, bool a_reversed, int b, bool b_reversed) {
+	int size_a = partition_offsets[a+1] - partition_offsets[a];
+	int size_b = partition_offsets[b+1] - partition_offsets[b];
+	long long int total = 0;
+
+	for (int j=0; j<window && j<size_b; j++) {
+		int r1 = segment_row(b, b_reversed, j);
+		for (int i=0; i<window-j && i<size_a; i++) {
+			int r0 = segment_row(a, a_reversed, size_a - 1 - i);
+			total += row_intersection_count(&edges[vertices[r0]], vertices[r0+1] - vertices[r0],
+			                                &edges[vertices[r1]], vertices[r1+1] - vertices[r1]);
+		}
+	}
+
+	return total;
+}
+
+/*
+
+Reorder every partition on its own worker with the windowed greedy, then
+stitch: starting from the partition holding row 0, greedily append the
+remaining partition and orientation with the highest junction affinity.
+
+*/
+long long int partition_row_reorder()
+{
+        auto t1 = high_resolution_clock::now();
+
+	build_partitions();
+
+        permutation = (int  *) malloc(metadata_rows * sizeof(int));
+	vector<int> row_positions(metadata_rows, -1); // Heap positions, shared by the disjoint partitions
+
+	parallel_for(0, partitions, [&](int p) { group_row_reorder(partition_offsets, partition_rows, partition_of, p, &row_positions); });
+
+	// Stitch the non-empty partitions
+	vector<int> chain;
+	vector<char> chain_reversed, stitched(partitions, 0);
+	for (int p=0; p<partitions; p++) if (partition_offsets[p+1] == partition_offsets[p]) stitched[p] = 1;
+	chain.push_back(partition_of[0]);
+	chain_reversed.push_back(0);
+	stitched[partition_of[0]] = 1;
+
+	vector<long long int> gain(2 * partitions);
+	while (true) {
+		int tail = chain.back();
+		bool tail_reversed = chain_reversed.back();
+		parallel_for(0, 2*partitions, [&](int candidate) {
+			int p = candidate / 2;
+			gain[candidate] = stitched[p] ? -1 : junction_affinity(tail, tail_reversed, p, candidate % 2);
+		});
+
+		int best = -1;
+		for (int candidate=0; candidate<2*partitions; candidate++)
+			if (gain[candidate] >= 0 && (best == -1 || gain[candidate] > gain[best])) best = candidate;
+		if (best == -1) break;
+
+		chain.push_back(best / 2);
+		chain_reversed.push_back(best % 2);
+		stitched[best / 2] = 1;
+	}
+
+	// Lay the segments out in chain order
+	int* stitched_permutation = (int *) malloc(metadata_rows * sizeof(int));
+	vector<int> chain_offsets(chain.size() + 1, 0);
+	for (size_t s=0; s<chain.size(); s++)
+		chain_offsets[s+1] = chain_offsets[s] + partition_offsets[chain[s]+1] - partition_offsets[chain[s]];
+	parallel_for(0, (int)chain.size(), [&](int s) {
+		for (int i=0; i<chain_offsets[s+1]-chain_offsets[s]; i++)
+			stitched_permutation[chain_offsets[s] + i] = segment_row(chain[s], chain_reversed[s], i);
+	});
+	free(permutation);
+	permutation = stitched_permutation;
+
+        auto t2 = high_resolution_clock::now();
+
+        auto ms_int = duration_cast<milliseconds>(t2-t1);
+
+	return ms_int.count();
+}
+
+/*
+
+Relaxed greedy over a MultiQueue
+
+Workers place rows concurrently. Each pops the better top of two random
+queues, claims the row by swapping its affinity for -1 (failing if the entry
+is stale or another worker got there first), takes the next permutation
+position, and applies the window increment and eviction through the tracked
+scatter. It then re-pushes every touched row with its current affinity into
+a random queue. Rows may therefore be placed slightly out of affinity order,
+and the window seen by one step may already include rows placed after it.
+
+An eviction can also land before the increment it undoes, so affinities
+start at MULTIQUEUE_BIAS rather than 0: a transiently negative count must
+never read as the -1 of a claimed row. Each worker keeps its own round
+stamps, so no other worker's stamps can make it list a row twice.
+
+*/
+inline unsigned long long int next_random(unsigned long long int* state) {
+	*state = splitmix64(*state);
+	return *state;
+}
+
+inline void lock_queue(relaxed_queue* q) {
+	while (__atomic_test_and_set(&q->lock, __ATOMIC_ACQUIRE));
+}
+
+inline void unlock_queue(relaxed_queue* q) {
+	__atomic_clear(&q->lock, __ATOMIC_RELEASE);
+}
+
+void multiqueue_push(int row, long long int affinity, unsigned long long int* rng) {
+	relaxed_queue* q = &multiqueue[next_random(rng) % multiqueue.size()];
+	lock_queue(q);
+	q->heap.push(make_pair(affinity, row));
+	__atomic_store_n(&q->top, q->heap.top().first, __ATOMIC_RELAXED);
+	unlock_queue(q);
+}
+
+/*
+
+Pop from the better of two random queues, falling back to the first
+non-empty queue after repeated misses. Returns -1 if nothing was popped.
+
+*/
+int multiqueue_pop(unsigned long long int* rng, long long int* affinity) {
+	int queues = multiqueue.size();
+	for (int attempt=0; attempt<=2*queues; attempt++) {
+		int a = next_random(rng) % queues, b = next_random(rng) % queues;
+		if (attempt == 2*queues) {
+			for (a=0; a<queues && __atomic_load_n(&multiqueue[a].top, __ATOMIC_RELAXED) < 0; a++);
+			if (a == queues) return -1;
+		} else if (__atomic_load_n(&multiqueue[b].top, __ATOMIC_RELAXED) > __atomic_load_n(&multiqueue[a].top, __ATOMIC_RELAXED)) {
+			a = b;
+		}
+
+		relaxed_queue* q = &multiqueue[a];
+		lock_queue(q);
+		if (q->heap.empty()) {
+			unlock_queue(q);
+			continue;
+		}
+		*affinity = q->heap.top().first;
+		int row = q->heap.top().second;
+		q->heap.pop();
+		__atomic_store_n(&q->top, q->heap.empty() ? -1 : q->heap.top().first, __ATOMIC_RELAXED);
+		unlock_queue(q);
+		return row;
+	}
+	return -1;
+}
+
+/*
+
+Push the current affinity of every row touched by a tracked scatter
+
+*/
+void multiqueue_push_touched(long long int* affinity_array, int* touched, int touched_count, unsigned long long int* rng) {
+	for (int i=0; i<touched_count; i++) {
+		long long int affinity = __atomic_load_n(&affinity_array[touched[i]], __ATOMIC_RELAXED);
+		if (affinity != (long long int)-1) multiqueue_push(touched[i], affinity, rng);
+	}
+}
+
+long long int multiqueue_row_reorder()
+{
+        auto t1 = high_resolution_clock::now();
+
+        long long int* affinity_array = (long long int *) numa_malloc(metadata_rows * sizeof(long long int)); // affinity array for row affinities
+	for (int i=0; i<metadata_rows; i++) affinity_array[i] = MULTIQUEUE_BIAS;
+	init_spa_arenas(multiqueue_workers);
+	multiqueue.clear();
+	multiqueue.resize(MULTIQUEUE_FACTOR * multiqueue_workers);
+	for (size_t i=0; i<multiqueue.size(); i++) {
+		multiqueue[i].lock = 0;
+		multiqueue[i].top = -1;
+	}
+
+        permutation = (int  *) malloc(metadata_rows * sizeof(int));
+	for (int i=0; i<metadata_rows; i++) permutation[i] = -1;
+
+        // Seed the permutation with the first row
+	unsigned long long int rng = 0;
+	for (int i=1; i<metadata_rows; i++) multiqueue_push(i, MULTIQUEUE_BIAS, &rng);
+        permutation[0] = 0;
+        affinity_array[0] = (long long int)-1;
+	int placed = 1;
+	spa_arena* seed_arena = &spa_arenas[0];
+	scatter_tracked_row_affinity(0, 1, affinity_array, 0, 1, seed_arena->row_round.data(), seed_arena->touched_rows.data(), &seed_arena->touched_count);
+	multiqueue_push_touched(affinity_array, seed_arena->touched_rows.data(), seed_arena->touched_count, &rng);
+
+	parallel_for(0, multiqueue_workers, [&](int w) {
+		unsigned long long int worker_rng = w + 1;
+		spa_arena* arena = &spa_arenas[w];
+
+		while (__atomic_load_n(&placed, __ATOMIC_RELAXED) < metadata_rows) {
+			long long int affinity;
+			int row = multiqueue_pop(&worker_rng, &affinity);
+			if (row < 0) continue;
+			if (!__atomic_compare_exchange_n(&affinity_array[row], &affinity, (long long int)-1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) continue;
+
+			int r_permutation = __atomic_fetch_add(&placed, 1, __ATOMIC_RELAXED);
+			__atomic_store_n(&permutation[r_permutation], row, __ATOMIC_RELEASE);
+
+			// Rows entering and leaving the window; positions are unique, so they serve as rounds
+			arena->touched_count = 0;
+			scatter_tracked_row_affinity(row, 1, affinity_array, 0, r_permutation+1, arena->row_round.data(), arena->touched_rows.data(), &arena->touched_count);
+			if (r_permutation >= window) {
+				int evicted;
+				// The evicting worker may not have stored it yet
+				while ((evicted = __atomic_load_n(&permutation[r_permutation-window], __ATOMIC_ACQUIRE)) < 0);
+				scatter_tracked_row_affinity(evicted, -1, affinity_array, 0, r_permutation+1, arena->row_round.data(), arena->touched_rows.data(), &arena->touched_count);
+			}
+			multiqueue_push_touched(affinity_array, arena->touched_rows.data(), arena->touched_count, &worker_rng);
+		}
+	});
+
+        auto t2 = high_resolution_clock::now();
+
+        auto ms_int = duration_cast<milliseconds>(t2-t1);
+
+	multiqueue.clear();
+	report_affinity_placement(affinity_array);
+	free(affinity_array);
+
+	return ms_int.count();
+}
+
+void print_permutation() {
+	cout<<"Printing row permuation."<<endl<<endl;
+	for (int i=0; i<metadata_rows; i++)  cout<<permutation[i]<<" ";
+	cout<<endl;
+}
+
+void free_all() {
+	if (csr_in_place) {
+		release_csr_text(&csr_input);
+	} else {
+		free(vertices);
+		free(edges);
+		free(values);
+	}
+	free(permutation);
+	free(col_vertices);
+	free(col_rows);
+	free(col_stride);
+	free(signatures);
+	free(row_chunks);
+	free(component_offsets);
+	free(component_rows);
+	free(partition_of);
+	free(partition_offsets);
+	free(partition_rows);
+}
+long long int parallel_row_intersection(int row_0_idx, int row_1_idx){
+	return hybrid_row_intersection(&bitmaps, vertices, edges, row_0_idx, row_1_idx);
 }
 
 /*
@@ -585,15 +1920,231 @@ void parallel_row_reorder() {
         // Algorithm tuning parameter
 */
 
-int main() {
+/*
+
+Parse -g: a comma-separated list of loop=grain settings
+
+*/
+bool parse_grains(const char* arg) {
+	char loop[32];
+	long long int grain;
+	int consumed;
+	while (sscanf(arg, "%31[a-z]=%lld%n", loop, &grain, &consumed) == 2) {
+		if (grain < 0) return false;
+		if (strcmp(loop, "intersect") == 0) intersect_grain = grain;
+		else if (strcmp(loop, "minhash") == 0) minhash_grain = grain;
+		else if (strcmp(loop, "union") == 0) union_grain = grain;
+		else if (strcmp(loop, "lp") == 0) lp_grain = grain;
+		else if (strcmp(loop, "normalize") == 0) normalize_grain = grain;
+		else if (strcmp(loop, "speculative") == 0 && grain > 0) speculation_grain = grain;
+		else return false;
+
+		arg += consumed;
+		if (*arg == '\0') return true;
+		if (*arg++ != ',') return false;
+	}
+	return false;
+}
+
+void print_usage(char *prog) {
+	cerr<<"Usage: "<<prog<<" [-e intersect|scatter|minhash|components|speculative|partition|multiqueue] [-k count] [-x] [-P partitions] [-w workers] [-b density] [-L bandsxrows] [-H degree|pct%] [-m skip|sample] [-R] [-N none|first-touch|interleave] [-A compact|spread] [-M] [-g loop=grain,...] [-p] < mat.csr"<<endl;
+	cerr<<"  -e  affinity engine (default: intersect)"<<endl;
+	cerr<<"  -b  intersect engine: keep bitmaps for rows at least this dense, 0 disables (default: "<<BITMAP_DEFAULT_DENSITY<<")"<<endl;
+	cerr<<"  -L  minhash engine: LSH bands and signature rows per band (default: "<<minhash_bands<<"x"<<minhash_band_rows<<")"<<endl;
+	cerr<<"  -k  speculative engine: candidates per top-k scan (default: "<<speculation_k<<")"<<endl;
+	cerr<<"  -x  speculative engine: commit whole top-k batches without validation (not exact)"<<endl;
+	cerr<<"  -P  partition engine: number of partitions reordered independently (default: "<<partitions<<")"<<endl;
+	cerr<<"  -w  multiqueue engine: workers placing rows concurrently, with "<<MULTIQUEUE_FACTOR<<" queues each (default: "<<multiqueue_workers<<")"<<endl;
+	cerr<<"  -H  scatter engine: treat columns shared by more than this many rows, or the top pct% of columns, as hubs"<<endl;
+	cerr<<"  -m  hub columns are skipped or sampled down to about the -H degree (default: skip)"<<endl;
+	cerr<<"  -R  also run without hub capping and report runtime saved and reuse quality lost"<<endl;
+	cerr<<"  -N  NUMA placement of the CSR arrays, column index and affinity arrays (default: none)"<<endl;
+	cerr<<"  -A  pin workers to CPUs filling one NUMA node at a time, or spread round-robin across nodes (default: unpinned)"<<endl;
+	cerr<<"  -M  report how each large array's pages are spread across NUMA nodes"<<endl;
+	cerr<<"  -g  per-loop grains: intersect, minhash, union, lp and normalize in nonzeros per chunk (default: 0, from the worker count),"<<endl;
+	cerr<<"      speculative in rows per scan block (default: "<<speculation_grain<<"), e.g. -g intersect=65536,lp=8192"<<endl;
+	cerr<<"  -p  print the row permutation after the runtime"<<endl;
+	cerr<<"Parallel runtime: "<<PARALLEL_RUNTIME_NAME<<endl;
+}
+
+int main(int argc, char *argv[]) {
+	const char *engine = "intersect";
+	const char *hub_arg = NULL;
+	bool print_perm = false, report_baseline = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "e:b:L:k:xP:w:H:m:RN:A:Mg:p")) != -1) {
+		switch (opt) {
+			case 'e': engine = optarg; break;
+			case 'b': bitmap_density = atof(optarg); break;
+			case 'L':
+				if (sscanf(optarg, "%dx%d", &minhash_bands, &minhash_band_rows) != 2 || minhash_bands < 1 || minhash_band_rows < 1) {
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'k':
+				speculation_k = atoi(optarg);
+				if (speculation_k < 1) {
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'x': speculation_relaxed = true; break;
+			case 'P':
+				partitions = atoi(optarg);
+				if (partitions < 1) {
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'w':
+				multiqueue_workers = atoi(optarg);
+				if (multiqueue_workers < 1) {
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'H': hub_arg = optarg; break;
+			case 'm':
+				if (strcmp(optarg, "skip") == 0) hub_mode = HUB_SKIP;
+				else if (strcmp(optarg, "sample") == 0) hub_mode = HUB_SAMPLE;
+				else {
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'R': report_baseline = true; break;
+			case 'N':
+				if (strcmp(optarg, "none") == 0) numa_policy = NUMA_NONE;
+				else if (strcmp(optarg, "first-touch") == 0) numa_policy = NUMA_FIRST_TOUCH;
+				else if (strcmp(optarg, "interleave") == 0) numa_policy = NUMA_INTERLEAVE;
+				else {
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'A':
+				if (strcmp(optarg, "compact") == 0) pin_mode = PIN_COMPACT;
+				else if (strcmp(optarg, "spread") == 0) pin_mode = PIN_SPREAD;
+				else {
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'M': placement_report = true; break;
+			case 'g':
+				if (!parse_grains(optarg)) {
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'p': print_perm = true; break;
+			default: print_usage(argv[0]); return 1;
+		}
+	}
+
+	// Pin before loading, so first-touch places pages from the pinned workers
+	if (pin_mode != PIN_NONE) {
+		vector<int> cpus = numa_pin_order(pin_mode == PIN_SPREAD);
+		int pinned = parallel_pin_workers(cpus.data(), cpus.size());
+		cout<<"Pinned "<<pinned<<" of "<<parallel_workers()<<" workers ("<<(pin_mode == PIN_SPREAD ? "spread" : "compact")<<")"<<endl;
+	}
+
 	cout<<"Loading..."<<endl;
 	load_mtx_csr_from_stdin();
+	normalize_csr();
 	print_csr();
 	cout<<"Parallel row-reordering..."<<endl;
-	parallel_row_reorder();
+	if (strcmp(engine, "intersect") == 0) {
+		build_row_bitmaps(&bitmaps, vertices, edges, metadata_rows, metadata_columns, bitmap_density);
+		cout<< parallel_row_reorder() << endl;
+	} else if (strcmp(engine, "scatter") == 0) {
+		build_column_index();
+		if (hub_arg != NULL) {
+			if (hub_arg[strlen(hub_arg)-1] == '%') hub_degree = hub_percentile_degree(atof(hub_arg));
+			else hub_degree = atoi(hub_arg);
+		}
+		int hubs = cap_hub_columns();
+
+		long long int ms = parallel_scatter_row_reorder();
+		cout<< ms << endl;
+
+		if (hub_degree > 0) {
+			long long int quality = window_affinity();
+			cout<<"Hub columns: "<<hubs<<" of "<<metadata_columns<<" (degree > "<<hub_degree<<", "<<(hub_mode == HUB_SKIP ? "skipped" : "sampled")<<")"<<endl;
+			cout<<"Window affinity: "<<quality<<endl;
+
+			if (report_baseline) {
+				// Rerun uncapped, keeping the capped permutation for -p
+				int *capped_permutation = permutation;
+				int capped_hub_degree = hub_degree;
+
+				hub_degree = 0;
+				cap_hub_columns();
+				long long int baseline_ms = parallel_scatter_row_reorder();
+				long long int baseline_quality = window_affinity();
+				free(permutation);
+				permutation = capped_permutation;
+				hub_degree = capped_hub_degree;
+
+				cout<<"Uncapped runtime: "<<baseline_ms<<" ms, window affinity: "<<baseline_quality<<endl;
+				cout<<"Runtime saved: "<<baseline_ms - ms<<" ms ("<<(baseline_ms > 0 ? 100.0 * (baseline_ms - ms) / baseline_ms : 0.0)<<"%)"<<endl;
+				cout<<"Reuse quality lost: "<<baseline_quality - quality<<" ("<<(baseline_quality > 0 ? 100.0 * (baseline_quality - quality) / baseline_quality : 0.0)<<"%)"<<endl;
+			}
+		}
+	} else if (strcmp(engine, "minhash") == 0) {
+		cout<< minhash_row_reorder() << endl;
+	} else if (strcmp(engine, "speculative") == 0) {
+		build_column_index();
+		// The speculative scatters skip no columns
+		hub_degree = 0;
+		cap_hub_columns();
+		cout<< speculative_row_reorder() << endl;
+	} else if (strcmp(engine, "partition") == 0) {
+		build_column_index();
+		cout<< partition_row_reorder() << endl;
+
+		int largest = 0;
+		for (int p=0; p<partitions; p++)
+			if (partition_offsets[p+1] - partition_offsets[p] > largest) largest = partition_offsets[p+1] - partition_offsets[p];
+		cout<<"Partitions: "<<partitions<<" (largest: "<<largest<<" rows)"<<endl;
+		cout<<"Window affinity: "<<window_affinity()<<endl;
+	} else if (strcmp(engine, "multiqueue") == 0) {
+		build_column_index();
+		// Neither run skips columns
+		hub_degree = 0;
+		cap_hub_columns();
+		long long int ms = multiqueue_row_reorder();
+		cout<< ms << endl;
+
+		// Compare against the exact greedy, keeping the relaxed permutation for -p
+		long long int quality = window_affinity();
+		int *relaxed_permutation = permutation;
+		long long int exact_ms = parallel_scatter_row_reorder();
+		long long int exact_quality = window_affinity();
+		free(permutation);
+		permutation = relaxed_permutation;
+
+		cout<<"Relaxed runtime: "<<ms<<" ms, window affinity: "<<quality<<endl;
+		cout<<"Exact runtime: "<<exact_ms<<" ms, window affinity: "<<exact_quality<<endl;
+		cout<<"Relaxed quality: "<<(exact_quality > 0 ? 100.0 * quality / exact_quality : 100.0)<<"% of exact"<<endl;
+	} else if (strcmp(engine, "components") == 0) {
+		build_column_index();
+		cout<< component_parallel_row_reorder() << endl;
+
+		int largest = 0;
+		for (int k=0; k<components; k++)
+			if (component_offsets[k+1] - component_offsets[k] > largest) largest = component_offsets[k+1] - component_offsets[k];
+		cout<<"Components: "<<components<<" (largest: "<<largest<<" rows)"<<endl;
+	} else {
+		print_usage(argv[0]);
+		return 1;
+	}
 //	cout<<"Intersecting rows..."<<endl;
 //	parallel_row_intersection();
-//	print_permutation();
+	report_placement();
+	if (print_perm) print_permutation();
 	cout<<"Freeing..."<<endl;
 	free_all();
 }
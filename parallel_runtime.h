@@ -0,0 +1,481 @@
+#ifndef PARALLEL_RUNTIME_H
+#define PARALLEL_RUNTIME_H
+
+// Portable parallel loops and reductions
+//
+// parallel_for(begin, end, body) runs body(i) for every i in [begin, end),
+// parallel_sum(begin, end, body) adds up body(i) as a long long, and
+// parallel_workers() is the number of workers the backend runs on. Loops may
+// nest. Bodies are lambdas, so `continue` becomes `return`.
+//
+// parallel_pin_workers(cpus, count) pins worker w to CPU cpus[w % count] and
+// returns the number of workers pinned (Linux only, 0 elsewhere).
+//
+// parallel_for_edges() and edge_balanced_blocks() split CSR row loops by
+// nonzeros rather than by rows; see below.
+//
+// The backend follows the compiler mode: OpenCilk under -fopencilk, OpenMP
+// under -fopenmp, and otherwise the built-in std::thread work-stealing pool
+// (sized by the PARALLEL_WORKERS environment variable, or one worker per
+// hardware thread). Define PARALLEL_RUNTIME_CILK, PARALLEL_RUNTIME_OPENMP or
+// PARALLEL_RUNTIME_THREADS to force one.
+#if !defined(PARALLEL_RUNTIME_CILK) && !defined(PARALLEL_RUNTIME_OPENMP) && !defined(PARALLEL_RUNTIME_THREADS)
+#if defined(__cilk)
+#define PARALLEL_RUNTIME_CILK
+#elif defined(_OPENMP)
+#define PARALLEL_RUNTIME_OPENMP
+#else
+#define PARALLEL_RUNTIME_THREADS
+#endif
+#endif
+
+#if defined(__linux__)
+#include <sched.h>
+#include <pthread.h>
+#define PARALLEL_RUNTIME_PINNING
+#endif
+
+#ifdef PARALLEL_RUNTIME_PINNING
+inline bool pin_thread_to_cpu(pthread_t thread, int cpu) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+#endif
+
+#if defined(PARALLEL_RUNTIME_CILK)
+
+#include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
+#include <cilk/reducer_opadd.h>
+
+#define PARALLEL_RUNTIME_NAME "opencilk"
+
+template <typename index_type, typename body_type>
+void parallel_for(index_type begin, index_type end, body_type body) {
+	cilk_for (index_type i=begin; i<end; i++) body(i);
+}
+
+template <typename index_type, typename body_type>
+long long int parallel_sum(index_type begin, index_type end, body_type body) {
+	cilk::reducer_opadd<long long int> sum;
+	cilk_for (index_type i=begin; i<end; i++) *sum += body(i);
+	return sum.get_value();
+}
+
+inline int parallel_workers() {
+	return __cilkrts_get_nworkers();
+}
+
+/*
+
+Cilk workers cannot be addressed directly, so pinning is best effort: a
+loop of many short iterations lets each worker that steals one pin itself
+once
+
+*/
+inline int parallel_pin_workers(const int* cpus, int count) {
+#ifdef PARALLEL_RUNTIME_PINNING
+	int workers = __cilkrts_get_nworkers();
+	char* pinned = (char*) calloc(workers, 1);
+	int total = 0;
+	cilk_for (int i=0; i<64*workers; i++) {
+		int w = __cilkrts_get_worker_number();
+		if (__atomic_exchange_n(&pinned[w], 1, __ATOMIC_RELAXED)) continue;
+		if (pin_thread_to_cpu(pthread_self(), cpus[w % count])) __atomic_fetch_add(&total, 1, __ATOMIC_RELAXED);
+	}
+	free(pinned);
+	return total;
+#else
+	return 0;
+#endif
+}
+
+#elif defined(PARALLEL_RUNTIME_OPENMP)
+
+#include <omp.h>
+
+#define PARALLEL_RUNTIME_NAME "openmp"
+
+/*
+
+Loops nested inside a parallel region run serially in the calling thread
+rather than opening a nested region
+
+*/
+template <typename index_type, typename body_type>
+void parallel_for(index_type begin, index_type end, body_type body) {
+	if (omp_in_parallel() || end - begin < 2) {
+		for (index_type i=begin; i<end; i++) body(i);
+		return;
+	}
+	#pragma omp parallel for schedule(guided)
+	for (index_type i=begin; i<end; i++) body(i);
+}
+
+template <typename index_type, typename body_type>
+long long int parallel_sum(index_type begin, index_type end, body_type body) {
+	long long int sum = 0;
+	if (omp_in_parallel() || end - begin < 2) {
+		for (index_type i=begin; i<end; i++) sum += body(i);
+		return sum;
+	}
+	#pragma omp parallel for schedule(guided) reduction(+:sum)
+	for (index_type i=begin; i<end; i++) sum += body(i);
+	return sum;
+}
+
+inline int parallel_workers() {
+	return omp_get_max_threads();
+}
+
+/*
+
+Every thread of the team pins itself; the runtime reuses the same threads
+for later regions of the same size
+
+*/
+inline int parallel_pin_workers(const int* cpus, int count) {
+	int total = 0;
+#ifdef PARALLEL_RUNTIME_PINNING
+	#pragma omp parallel reduction(+:total)
+	total += pin_thread_to_cpu(pthread_self(), cpus[omp_get_thread_num() % count]);
+#endif
+	return total;
+}
+
+#else
+
+#include <stdlib.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define PARALLEL_RUNTIME_NAME "threads"
+#define PARALLEL_SPLITS_PER_WORKER 8 // Leaf ranges per worker, as cilk_for's default grain
+#define PARALLEL_IDLE_SPINS 4096 // Yields before an idle worker blocks
+
+/*
+
+Work-stealing std::thread pool
+
+A loop is a job over an index range. Whoever runs a range halves it,
+pushing the upper halves onto its own deque, until it reaches the job's
+grain, then runs the rest itself. Owners pop their deque from the back and
+idle workers steal from the front of the others. A thread waiting for its
+job keeps running tasks, but only ranges of that job or of loops nested in
+it: picking up an unrelated task would bury the waiting loop under work
+that may itself wait on it. Idle workers spin while any job is live and
+block on a condition variable once the pool has been quiet for a while.
+
+Key invariants:
+- job.pending counts the job's ranges pushed or running but not finished
+- job.parent is the job whose range was running when the loop started, or
+  NULL at top level; it outlives the job, since its range waits for it
+- Worker 0 is the thread that first calls into the pool; pool threads are
+  workers 1 .. workers-1
+
+*/
+namespace parallel_runtime {
+
+typedef struct job {
+	struct job* parent;
+	void (*run)(void* body, long long int begin, long long int end, long long int* sum);
+	void* body;
+	long long int grain;
+	long long int pending;
+	long long int sum;
+} job;
+
+typedef struct range_task {
+	job* owner;
+	long long int begin, end;
+} range_task;
+
+typedef struct worker_deque {
+	std::mutex lock;
+	std::deque<range_task> tasks;
+} worker_deque;
+
+static thread_local int worker_index = 0;
+static thread_local job* current_job = NULL;
+
+inline bool nested_in(job* j, job* ancestor) {
+	for (; j != NULL; j = j->parent) if (j == ancestor) return true;
+	return false;
+}
+
+class thread_pool {
+public:
+	int workers;
+	std::vector<worker_deque> deques;
+	std::vector<std::thread> threads;
+	std::atomic<int> live_jobs, sleepers;
+	std::atomic<bool> stop;
+	std::mutex sleep_lock;
+	std::condition_variable wake;
+
+	thread_pool() : live_jobs(0), sleepers(0), stop(false) {
+		const char* env = getenv("PARALLEL_WORKERS");
+		workers = env ? atoi(env) : (int)std::thread::hardware_concurrency();
+		if (workers < 1) workers = 1;
+		deques = std::vector<worker_deque>(workers);
+		for (int w=1; w<workers; w++) threads.push_back(std::thread(&thread_pool::worker_loop, this, w));
+	}
+
+	~thread_pool() {
+		stop = true;
+		{
+			std::lock_guard<std::mutex> guard(sleep_lock);
+			wake.notify_all();
+		}
+		for (size_t i=0; i<threads.size(); i++) threads[i].join();
+	}
+
+	void push(range_task task) {
+		worker_deque& d = deques[worker_index];
+		std::lock_guard<std::mutex> guard(d.lock);
+		d.tasks.push_back(task);
+	}
+
+	// Take a task from the back of our deque or the front of another, only
+	// from within waiting_for when it is set
+	bool pop_or_steal(range_task* task, job* waiting_for) {
+		for (int k=0; k<workers; k++) {
+			worker_deque& d = deques[(worker_index + k) % workers];
+			std::lock_guard<std::mutex> guard(d.lock);
+			if (d.tasks.empty()) continue;
+			range_task& candidate = (k == 0) ? d.tasks.back() : d.tasks.front();
+			if (waiting_for != NULL && !nested_in(candidate.owner, waiting_for)) continue;
+			*task = candidate;
+			if (k == 0) d.tasks.pop_back();
+			else d.tasks.pop_front();
+			return true;
+		}
+		return false;
+	}
+
+	void execute(range_task task) {
+		job* j = task.owner;
+		job* outer_job = current_job;
+		current_job = j;
+		long long int begin = task.begin, end = task.end;
+		while (end - begin > j->grain) {
+			long long int mid = begin + (end - begin) / 2;
+			__atomic_fetch_add(&j->pending, 1, __ATOMIC_RELAXED);
+			range_task upper = {j, mid, end};
+			push(upper);
+			end = mid;
+		}
+		j->run(j->body, begin, end, &j->sum);
+		current_job = outer_job;
+		__atomic_fetch_sub(&j->pending, 1, __ATOMIC_ACQ_REL);
+	}
+
+	bool run_one(job* waiting_for) {
+		range_task task;
+		if (!pop_or_steal(&task, waiting_for)) return false;
+		execute(task);
+		return true;
+	}
+
+	void run_job(job* j, long long int begin, long long int end) {
+		if (live_jobs.fetch_add(1) == 0 && sleepers.load() > 0) {
+			std::lock_guard<std::mutex> guard(sleep_lock);
+			wake.notify_all();
+		}
+
+		j->parent = current_job;
+		range_task root = {j, begin, end};
+		execute(root);
+		while (__atomic_load_n(&j->pending, __ATOMIC_ACQUIRE) > 0) {
+			if (!run_one(j)) std::this_thread::yield();
+		}
+
+		live_jobs.fetch_sub(1);
+	}
+
+	void worker_loop(int w) {
+		worker_index = w;
+		int idle = 0;
+		while (!stop) {
+			if (run_one(NULL)) {
+				idle = 0;
+				continue;
+			}
+			if (live_jobs.load() > 0 || ++idle < PARALLEL_IDLE_SPINS) {
+				std::this_thread::yield();
+				continue;
+			}
+
+			std::unique_lock<std::mutex> guard(sleep_lock);
+			sleepers++;
+			wake.wait(guard, [this] { return stop.load() || live_jobs.load() > 0; });
+			sleepers--;
+			idle = 0;
+		}
+	}
+};
+
+inline thread_pool& pool() {
+	static thread_pool the_pool;
+	return the_pool;
+}
+
+template <typename index_type, typename body_type>
+void run_range(void* body, long long int begin, long long int end, long long int*) {
+	body_type& f = *(body_type*)body;
+	for (long long int i=begin; i<end; i++) f((index_type)i);
+}
+
+template <typename index_type, typename body_type>
+void sum_range(void* body, long long int begin, long long int end, long long int* sum) {
+	body_type& f = *(body_type*)body;
+	long long int partial = 0;
+	for (long long int i=begin; i<end; i++) partial += f((index_type)i);
+	__atomic_fetch_add(sum, partial, __ATOMIC_RELAXED);
+}
+
+inline long long int run(void (*range)(void*, long long int, long long int, long long int*), void* body,
+                         long long int begin, long long int end) {
+	thread_pool& p = pool();
+	long long int grain = (end - begin) / (PARALLEL_SPLITS_PER_WORKER * p.workers);
+	job j = {NULL, range, body, grain > 1 ? grain : 1, 1, 0};
+	if (p.workers == 1 || end - begin < 2) range(body, begin, end, &j.sum);
+	else p.run_job(&j, begin, end);
+	return j.sum;
+}
+
+}
+
+template <typename index_type, typename body_type>
+void parallel_for(index_type begin, index_type end, body_type body) {
+	if (end <= begin) return;
+	parallel_runtime::run(parallel_runtime::run_range<index_type, body_type>, &body, begin, end);
+}
+
+template <typename index_type, typename body_type>
+long long int parallel_sum(index_type begin, index_type end, body_type body) {
+	if (end <= begin) return 0;
+	return parallel_runtime::run(parallel_runtime::sum_range<index_type, body_type>, &body, begin, end);
+}
+
+inline int parallel_workers() {
+	return parallel_runtime::pool().workers;
+}
+
+inline int parallel_pin_workers(const int* cpus, int count) {
+	int total = 0;
+#ifdef PARALLEL_RUNTIME_PINNING
+	parallel_runtime::thread_pool& p = parallel_runtime::pool();
+	// Worker 0 is the calling thread
+	total += pin_thread_to_cpu(pthread_self(), cpus[0]);
+	for (size_t i=0; i<p.threads.size(); i++) total += pin_thread_to_cpu(p.threads[i].native_handle(), cpus[(i+1) % count]);
+#endif
+	return total;
+}
+
+#endif
+
+#include <vector>
+
+/*
+
+Edge-weighted row loops
+
+Splitting a row loop by row count hands one worker every chunk holding a
+power-law hub row. Instead, each row weighs one unit plus its nonzeros, laid
+out in row order: row r's unit sits at offsets[r] - offsets[0] + r and its
+nonzero e right after, at e - offsets[0] + r + 1. The total weight is cut
+into chunks of grain units, found by binary search over that prefix sum,
+so every chunk carries the same edge work whatever the degrees.
+
+A grain of 0 or less picks PARALLEL_WEIGHTED_SPLITS chunks per worker.
+
+*/
+#define PARALLEL_WEIGHTED_SPLITS 8
+
+inline long long int edge_weight_grain(const int* offsets, int rows, long long int grain) {
+	if (grain > 0) return grain;
+	long long int total = (long long int)(offsets[rows] - offsets[0]) + rows;
+	grain = total / (PARALLEL_WEIGHTED_SPLITS * parallel_workers());
+	return grain > 1 ? grain : 1;
+}
+
+// Last row whose unit sits at or before weight position w
+inline int edge_weight_row(const int* offsets, int rows, long long int w) {
+	int lo = 0, hi = rows - 1;
+	while (lo < hi) {
+		int mid = lo + (hi - lo + 1) / 2;
+		if ((long long int)(offsets[mid] - offsets[0]) + mid <= w) lo = mid;
+		else hi = mid - 1;
+	}
+	return lo;
+}
+
+/*
+
+Run body(row, e_begin, e_end) over edge-balanced chunks of rows 0 .. rows-1,
+where offsets is a CSR row pointer (offsets[r] .. offsets[r+1]-1 are row
+r's nonzeros). Rows longer than a chunk are split across chunks: body then
+sees the same row several times, each with a disjoint slice of its nonzeros,
+and must merge the partial results itself (atomically, since the slices run
+in parallel). Exactly one call for a row has e_begin == offsets[row], and a
+row with no nonzeros gets a single empty call.
+
+*/
+template <typename body_type>
+void parallel_for_edges(const int* offsets, int rows, long long int grain, body_type body) {
+	if (rows <= 0) return;
+	long long int base = offsets[0];
+	long long int total = (offsets[rows] - base) + rows;
+	grain = edge_weight_grain(offsets, rows, grain);
+	long long int chunks = (total + grain - 1) / grain;
+
+	parallel_for((long long int)0, chunks, [&](long long int c) {
+		long long int lo = c * grain, hi = (lo + grain < total) ? lo + grain : total;
+		// Only the first and last rows touching the chunk can be cut
+		int first = edge_weight_row(offsets, rows, lo), last = edge_weight_row(offsets, rows, hi - 1);
+		auto clipped = [&](int r) {
+			long long int e_begin = lo + base - r - 1, e_end = hi + base - r - 1;
+			if (e_begin < offsets[r]) e_begin = offsets[r];
+			if (e_end > offsets[r+1]) e_end = offsets[r+1];
+			if (e_begin < e_end) body(r, (int)e_begin, (int)e_end);
+			else if (offsets[r] == offsets[r+1] && (offsets[r] - base) + r >= lo) body(r, offsets[r], offsets[r]);
+		};
+
+		clipped(first);
+		for (int r=first+1; r<last; r++) body(r, offsets[r], offsets[r+1]);
+		if (last > first) clipped(last);
+	});
+}
+
+/*
+
+Cut rows 0 .. rows-1 into blocks of whole rows of about grain weight each,
+for loops whose rows cannot be split: block b is rows blocks[b] ..
+blocks[b+1]-1. A row heavier than the grain gets a block of its own.
+
+*/
+inline std::vector<int> edge_balanced_blocks(const int* offsets, int rows, long long int grain) {
+	std::vector<int> blocks(1, 0);
+	if (rows <= 0) return blocks;
+	long long int base = offsets[0];
+	long long int total = (offsets[rows] - base) + rows;
+	grain = edge_weight_grain(offsets, rows, grain);
+
+	for (long long int w=grain; w<total; w+=grain) {
+		// Cut before the first row starting at or after w
+		int r = edge_weight_row(offsets, rows, w);
+		if ((offsets[r] - base) + r < w) r++;
+		if (r > blocks.back() && r < rows) blocks.push_back(r);
+	}
+	blocks.push_back(rows);
+	return blocks;
+}
+
+#endif
@@ -0,0 +1,316 @@
+#include <iostream>
+#include <cstdio>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <vector>
+#include <chrono>
+#include "parallel_runtime.h"
+#include "csr_parser.h"
+#include "csr_binary.h"
+#include "csr_normalize.h"
+
+using namespace std;
+using std::chrono::high_resolution_clock;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+
+#define RADIX_BITS 11 // Key bits sorted per pass
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_BLOCKS_PER_WORKER 4
+
+// Asymmetric matrix metadata, from the .mtx metadata line
+int metadata_rows = 0;
+int metadata_columns = 0;
+int metadata_edges = 0;
+
+// Asymmetric compressed-sparse row (CSR) representation
+// *edges and *values must be allocated to length metadata_edges
+// *vertices must be allocated to length metadata_rows + 1
+//
+// Key invariants:
+// - Each edge is a destination node from the adjacency list
+// - Within a row, edges are strictly increasing: repeated edges are coalesced,
+//   summing their values
+// - vertices is sorted (i.e. index corresponds to vertex id)
+// - The egress-degree of vertex v is vertices[v+1] - vertices[v]
+// - The last element of vertices is a dummy equal to metadata_edges,
+//   to ensure that the last vertex's degree can be calculated
+//
+int *vertices, *edges;
+double *values;
+
+// Edges as packed sort keys, source << column_bits | destination, with
+// their values alongside; the _tmp buffers receive each radix pass
+int column_bits = 0;
+uint64_t *keys, *keys_tmp;
+double *key_values, *key_values_tmp;
+
+// Bits needed to hold every index below count
+int index_bits(long long int count) {
+	int bits = 0;
+	while (bits < 62 && (1LL << bits) < count) bits++;
+	return bits;
+}
+
+inline const char* skip_blanks(const char* p, const char* end) {
+	while (p < end && (*p == ' ' || *p == '\t')) p++;
+	return p;
+}
+
+/*
+
+Parse the .mtx on stdin into keys and key_values
+
+Format:
+* Comment preamble
+* Metadata line
+* One edge per line: source destination [value], 1-indexed
+* EOF (trailing blank lines are ignored)
+
+The body is cut into newline-aligned chunks whose lines are counted in
+parallel (see split_csr_lines()), and each chunk then converts its lines
+with std::from_chars straight into their key slots. A missing value reads
+as 0, as in sut.
+
+*/
+void load_mtx_from_stdin() {
+
+	csr_text text;
+
+	cout<<"Loading adjacency list..."<<endl;
+	if (!read_csr_text(STDIN_FILENO, &text)) {
+		cerr<<"Failed to read the .mtx matrix."<<endl;
+		exit(1);
+	}
+
+	// Skip the comment preamble
+	size_t metadata = 0;
+	while (metadata < text.length && text.data[metadata] == '%') metadata = next_line(&text, metadata);
+
+	// Extract metadata
+	const char* end = text.data + text.length;
+	const char* p = text.data + metadata;
+	int* fields[3] = {&metadata_rows, &metadata_columns, &metadata_edges};
+	for (int f=0; f<3; f++) {
+		p = skip_blanks(p, end);
+		std::from_chars_result parsed = std::from_chars(p, end, *fields[f]);
+		if (parsed.ec != std::errc()) {
+			cerr<<"Malformed .mtx metadata line."<<endl;
+			exit(1);
+		}
+		p = parsed.ptr;
+	}
+	cout<<"- Rows: "<<metadata_rows<<" Columns: "<<metadata_columns<<" Edges: "<<metadata_edges<<endl;
+
+	vector<size_t> bounds;
+	vector<long long int> offsets;
+	// Trailing blank lines are not edges
+	size_t body = next_line(&text, p - text.data), body_end = text.length;
+	while (body_end > body && isspace((unsigned char) text.data[body_end-1])) body_end--;
+	long long int lines = split_csr_lines(&text, body, body_end, bounds, offsets);
+	if (lines != metadata_edges) {
+		cerr<<"Malformed .mtx: the metadata line declares "<<metadata_edges<<" edges but "<<lines<<" edge lines follow."<<endl;
+		exit(1);
+	}
+
+	column_bits = index_bits(metadata_columns);
+	keys = (uint64_t *) malloc(metadata_edges * sizeof(uint64_t));
+	key_values = (double *) malloc(metadata_edges * sizeof(double));
+
+	bool out_of_range = false;
+	parallel_for((long long int)0, (long long int)bounds.size() - 1, [&](long long int k) {
+		const char* line = text.data + bounds[k];
+		const char* chunk_end = text.data + bounds[k+1];
+		for (long long int i=offsets[k]; i<offsets[k+1]; i++) {
+			int source = 0, destination = 0;
+			double value = 0;
+			const char* q = skip_blanks(line, chunk_end);
+			q = skip_blanks(std::from_chars(q, chunk_end, source).ptr, chunk_end);
+			q = skip_blanks(std::from_chars(q, chunk_end, destination).ptr, chunk_end);
+			q = std::from_chars(q, chunk_end, value).ptr;
+			while (q < chunk_end && *q != '\n') q++;
+			line = q + 1;
+
+			// Convert 1-indexing of vertices to 0-indexing
+			if (source < 1 || source > metadata_rows || destination < 1 || destination > metadata_columns) {
+				__atomic_store_n(&out_of_range, true, __ATOMIC_RELAXED);
+				source = destination = 1;
+			}
+			keys[i] = ((uint64_t)(source - 1) << column_bits) | (uint64_t)(destination - 1);
+			key_values[i] = value;
+		}
+	});
+	if (out_of_range) {
+		cerr<<"Malformed .mtx: an edge lies outside the "<<metadata_rows<<"x"<<metadata_columns<<" matrix."<<endl;
+		exit(1);
+	}
+
+	release_csr_text(&text);
+}
+
+/*
+
+Stable LSD radix sort of keys[0, n) and their values by the low key_bits
+bits, RADIX_BITS per pass, ping-ponging with the _tmp buffers. Each pass
+cuts the keys into blocks that histogram their digits in parallel; a
+digit-major prefix sum over the block histograms gives every block its
+run of each bucket, and the blocks then scatter in parallel. Passes where
+every key has the same digit are skipped. Returns the passes run.
+
+*/
+int radix_sort_keys(long long int n, int key_bits) {
+	long long int blocks = (long long int) parallel_workers() * RADIX_BLOCKS_PER_WORKER;
+	long long int block_size = (n + blocks - 1) / blocks;
+	if (block_size == 0) return 0;
+	vector<long long int> histograms(blocks * RADIX_BUCKETS);
+	int passes = 0;
+
+	for (int shift=0; shift<key_bits; shift+=RADIX_BITS) {
+		std::fill(histograms.begin(), histograms.end(), 0);
+		parallel_for((long long int)0, blocks, [&](long long int b) {
+			long long int* histogram = &histograms[b * RADIX_BUCKETS];
+			long long int last = std::min(n, (b + 1) * block_size);
+			for (long long int i=b*block_size; i<last; i++) histogram[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+		});
+
+		// Bucket d of block b starts after every smaller digit and after bucket d of every earlier block
+		long long int offset = 0;
+		bool single_bucket = false;
+		for (int d=0; d<RADIX_BUCKETS; d++) {
+			long long int bucket = 0;
+			for (long long int b=0; b<blocks; b++) {
+				long long int count = histograms[b * RADIX_BUCKETS + d];
+				histograms[b * RADIX_BUCKETS + d] = offset;
+				offset += count;
+				bucket += count;
+			}
+			if (bucket == n) single_bucket = true;
+		}
+		if (single_bucket) continue;
+
+		parallel_for((long long int)0, blocks, [&](long long int b) {
+			long long int* next = &histograms[b * RADIX_BUCKETS];
+			long long int last = std::min(n, (b + 1) * block_size);
+			for (long long int i=b*block_size; i<last; i++) {
+				long long int slot = next[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+				keys_tmp[slot] = keys[i];
+				key_values_tmp[slot] = key_values[i];
+			}
+		});
+		std::swap(keys, keys_tmp);
+		std::swap(key_values, key_values_tmp);
+		passes++;
+	}
+	return passes;
+}
+
+/*
+
+Coalesce repeated edges, which the sort has made neighbours within each
+row, summing their values (see csr_normalize.h). Returns how many were
+coalesced.
+
+*/
+long long int coalesce_csr() {
+	vector<int> degrees(metadata_rows);
+	long long int rows_sorted = 0;
+	long long int kept = sort_csr_rows(metadata_rows, vertices, edges, values, degrees.data(), 0, &rows_sorted);
+	if (kept == metadata_edges) return 0;
+
+	int* normal_vertices = (int *) malloc((metadata_rows + 1) * sizeof(int));
+	int* normal_edges = (int *) malloc(kept * sizeof(int));
+	double* normal_values = (double *) malloc(kept * sizeof(double));
+	compact_csr_rows(metadata_rows, vertices, edges, values, degrees.data(), 0, normal_vertices, normal_edges, normal_values);
+	free(vertices);
+	free(edges);
+	free(values);
+	vertices = normal_vertices;
+	edges = normal_edges;
+	values = normal_values;
+
+	long long int coalesced = metadata_edges - kept;
+	metadata_edges = kept;
+	return coalesced;
+}
+
+/*
+
+Build the CSR arrays from the sorted keys. Every row's first edge is where
+the source changes between neighbouring keys, so each edge fills in the
+vertices entries of the rows from its predecessor's source up to its own:
+the same offsets a prefix sum over the row degrees gives, in one parallel
+pass with no degree array.
+
+*/
+void convert_keys_to_csr() {
+	long long int n = metadata_edges;
+	edges = (int *) malloc(n * sizeof(int));
+	vertices = (int *) malloc((metadata_rows + 1) * sizeof(int));
+	values = key_values;
+	key_values = NULL;
+
+	uint64_t column_mask = (1ULL << column_bits) - 1;
+	parallel_for((long long int)0, n, [&](long long int i) {
+		int source = keys[i] >> column_bits;
+		int previous = (i > 0) ? (int)(keys[i-1] >> column_bits) : -1;
+		for (int r=previous+1; r<=source; r++) vertices[r] = i;
+		edges[i] = keys[i] & column_mask;
+	});
+	int last = (n > 0) ? (int)(keys[n-1] >> column_bits) : -1;
+	parallel_for(last + 1, metadata_rows + 1, [&](int r) {
+		vertices[r] = n;
+	});
+}
+
+int main(int argc, char *argv[]) {
+
+	// -b writes mat.csrb instead of mat.csr
+	bool binary = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "b")) != -1) {
+		if (opt == 'b') binary = true;
+		else {
+			cerr<<"Usage: "<<argv[0]<<" [-b] < /path/to/mtx"<<endl;
+			cerr<<"Parallel runtime: "<<PARALLEL_RUNTIME_NAME<<endl;
+			return 1;
+		}
+	}
+
+	auto t1 = high_resolution_clock::now();
+	load_mtx_from_stdin();
+	auto t2 = high_resolution_clock::now();
+
+	keys_tmp = (uint64_t *) malloc(metadata_edges * sizeof(uint64_t));
+	key_values_tmp = (double *) malloc(metadata_edges * sizeof(double));
+	int passes = radix_sort_keys(metadata_edges, index_bits(metadata_rows) + column_bits);
+	free(keys_tmp);
+	free(key_values_tmp);
+	auto t3 = high_resolution_clock::now();
+
+	convert_keys_to_csr();
+	free(keys);
+	long long int coalesced = coalesce_csr();
+	auto t4 = high_resolution_clock::now();
+
+	cout<<"Parse: "<<duration_cast<milliseconds>(t2-t1).count()<<" ms"<<endl;
+	cout<<"Radix sort: "<<duration_cast<milliseconds>(t3-t2).count()<<" ms ("<<passes<<" passes)"<<endl;
+	cout<<"CSR build: "<<duration_cast<milliseconds>(t4-t3).count()<<" ms ("<<coalesced<<" repeated edges coalesced)"<<endl;
+
+	const char* path = binary ? "mat.csrb" : "mat.csr";
+	cout<<"Saving CSR representation to "<<path<<"."<<endl;
+	FILE* fp = fopen(path, binary ? "wb" : "w");
+	bool saved = fp != NULL && (binary ? write_csr_binary(fp, metadata_rows, metadata_columns, metadata_edges, vertices, edges, values)
+	                                   : write_csr_text(fp, metadata_rows, metadata_columns, metadata_edges, vertices, edges, values));
+	if (fp == NULL || fclose(fp) != 0 || !saved) {
+		cerr<<"Failed to write "<<path<<"."<<endl;
+		return 1;
+	}
+
+	free(vertices);
+	free(edges);
+	free(values);
+	return 0;
+}
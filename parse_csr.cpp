@@ -0,0 +1,128 @@
+#include <iostream>
+#include <cstdio>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <chrono>
+#include "csr_parser.h"
+
+using namespace std;
+using chrono::high_resolution_clock;
+using chrono::duration_cast;
+using chrono::nanoseconds;
+
+// Parsed CSR arrays of one loader
+typedef struct csr_arrays {
+	int rows, columns, edges;
+	vector<int> vertices, edge_columns;
+	vector<double> values;
+} csr_arrays;
+
+/*
+
+The line-at-a-time loader the tools used before csr_parser.h: getline,
+strcmp against the section markers, sscanf on every number. It reads from
+a memory stream over the same buffer, so both loaders are timed on parsing
+alone.
+
+*/
+bool getline_parse(const csr_text* text, csr_arrays* out) {
+	FILE* in = fmemopen(text->data, text->length, "r");
+	if (in == NULL) return false;
+
+	char *serialized_data = NULL;
+	size_t len = 0;
+
+	if (getline(&serialized_data, &len, in) == EOF) return false;
+	sscanf(serialized_data, "%d %d %d", &out->rows, &out->columns, &out->edges);
+	out->vertices.assign(out->rows + 1, 0);
+	out->edge_columns.assign(out->edges, 0);
+	out->values.assign(out->edges, 0);
+
+	if (getline(&serialized_data, &len, in) == EOF || strcmp(serialized_data, "VERTICES\n") != 0) return false;
+
+	int i=0;
+	while (getline(&serialized_data, &len, in) != EOF && strcmp(serialized_data, "EDGES\n") != 0) {
+		assert(i < (out->rows+1));
+		sscanf(serialized_data, "%d", &out->vertices[i++]);
+	}
+
+	i=0;
+	while (getline(&serialized_data, &len, in) != EOF && strcmp(serialized_data, "VALUES\n") != 0) {
+		assert(i < out->edges);
+		sscanf(serialized_data, "%d", &out->edge_columns[i++]);
+	}
+
+	i=0;
+	while (getline(&serialized_data, &len, in) != EOF) {
+		assert(i < out->edges);
+		sscanf(serialized_data, "%lf", &out->values[i++]);
+	}
+
+	free(serialized_data);
+	fclose(in);
+	return true;
+}
+
+bool chunked_parse(csr_text* text, csr_arrays* out) {
+	if (!parse_csr_metadata(text, &out->rows, &out->columns, &out->edges)) return false;
+	out->vertices.resize(out->rows + 1);
+	out->edge_columns.resize(out->edges);
+	out->values.resize(out->edges);
+
+	return parse_csr_section(text, text->vertices_begin, text->vertices_end, out->vertices.data(), out->rows + 1) >= 0 &&
+	       parse_csr_section(text, text->edges_begin, text->edges_end, out->edge_columns.data(), out->edges) >= 0 &&
+	       parse_csr_section(text, text->values_begin, text->values_end, out->values.data(), out->edges) >= 0;
+}
+
+void report(const char* name, double ns, size_t bytes, int iterations) {
+	printf("%-8s %10.1f ms %8.3f GB/s\n", name, ns / iterations / 1e6, ((double)bytes) * iterations / ns);
+}
+
+int main(int argc, char *argv[]) {
+
+	int iterations = (argc > 1) ? atoi(argv[1]) : 1;
+	if (iterations < 1) {
+		fprintf(stderr, "Usage: %s [iterations] < mat.csr\n", argv[0]);
+		return 1;
+	}
+
+	csr_text text;
+	if (!read_csr_text(STDIN_FILENO, &text)) {
+		fprintf(stderr, "Failed to read the CSR matrix.\n");
+		return 1;
+	}
+
+	csr_arrays expected, parsed;
+	double getline_ns = 0, chunked_ns = 0;
+	for (int it=0; it<iterations; it++) {
+		auto t1 = high_resolution_clock::now();
+		bool ok = getline_parse(&text, &expected);
+		auto t2 = high_resolution_clock::now();
+		ok = ok && chunked_parse(&text, &parsed);
+		auto t3 = high_resolution_clock::now();
+		if (!ok) {
+			fprintf(stderr, "Malformed CSR matrix.\n");
+			return 1;
+		}
+		getline_ns += duration_cast<nanoseconds>(t2-t1).count();
+		chunked_ns += duration_cast<nanoseconds>(t3-t2).count();
+	}
+
+	printf("bytes %zu rows %d columns %d edges %d iterations %d\n", text.length, parsed.rows, parsed.columns, parsed.edges, iterations);
+	report("getline", getline_ns, text.length, iterations);
+	report("chunked", chunked_ns, text.length, iterations);
+	printf("Speedup: %.2fx on %d %s workers\n", getline_ns / chunked_ns, parallel_workers(), PARALLEL_RUNTIME_NAME);
+
+	// Both loaders must produce the same arrays
+	if (expected.rows != parsed.rows || expected.columns != parsed.columns || expected.edges != parsed.edges ||
+	    expected.vertices != parsed.vertices || expected.edge_columns != parsed.edge_columns || expected.values != parsed.values) {
+		fprintf(stderr, "Loader results disagree.\n");
+		return 1;
+	}
+
+	release_csr_text(&text);
+	return 0;
+}
@@ -4,6 +4,8 @@
 #include <assert.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include "csr_binary.h"
 
 using namespace std;
 
@@ -157,6 +159,27 @@ void save_csr() {
 
 }
 
+/*
+
+Save CSR representation to a binary container file (see csr_binary.h).
+
+*/
+
+void save_csr_binary() {
+        FILE * fp;
+
+        fp = fopen("mat.csrb", "wb");
+
+        printf("Saving CSR representation to binary file.\n");
+        if (fp == NULL || !write_csr_binary(fp, metadata_rows, metadata_columns, metadata_edges, vertices, edges, values)) {
+                fprintf(stderr, "Failed to write mat.csrb.\n");
+                exit(1);
+        }
+
+        fclose(fp);
+
+}
+
 void free_all() {
         free(vertices);
         free(edges);
@@ -165,7 +188,18 @@ void free_all() {
 
 int main(int argc, char *argv[]) {
 
-	assert(argc == 4);
+	// -b writes mat.csrb instead of mat.csr
+	bool binary = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "b")) != -1) {
+		if (opt == 'b') binary = true;
+		else break;
+	}
+	if (argc - optind != 3) {
+		fprintf(stderr, "Usage: %s [-b] <rows> <columns> <density percent>\n", argv[0]);
+		return 1;
+	}
+	argv += optind - 1;
 
 	metadata_rows = atoi(argv[1]);
 	metadata_columns = atoi(argv[2]);
@@ -180,7 +214,8 @@ int main(int argc, char *argv[]) {
 
 	random_square_csr();
 	print_csr();
-        save_csr();
+        if (binary) save_csr_binary();
+        else save_csr();
         //free_all();
 
         return 0;
@@ -0,0 +1,339 @@
+#ifndef ROW_INTERSECTION_H
+#define ROW_INTERSECTION_H
+
+#include <vector>
+#include "parallel_runtime.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ROW_INTERSECTION_X86
+#endif
+
+// Sorted-set intersection kernels over CSR edge segments
+//
+// Every kernel counts the columns shared by two rows, given as pointers into
+// edges plus their lengths. Rows must be sorted and duplicate-free, which is
+// the CSR invariant the reorderers already rely on.
+//
+// Tuning parameters for row_intersection_count()
+#define GALLOP_RATIO 32 // Gallop once the longer row is this many times the shorter
+#define MERGE_PATH_MIN_LENGTH (1 << 15) // Split merges of at least this many elements
+#define MERGE_PATH_GRAIN (1 << 13) // Elements per merge-path partition
+#define BITMAP_DEFAULT_DENSITY (1.0/64) // Rows at least this dense get a bitmap
+
+/*
+
+All-pairs kernel: compare every edge of one row against every edge of the
+other. O(d0*d1) work, kept as the baseline the other kernels replace.
+
+*/
+long long int intersect_all_pairs(const int* row_0, int d0, const int* row_1, int d1) {
+	long long int total_edge_combinations = ((long long int)d0)*d1;
+	return parallel_sum((long long int)0, total_edge_combinations, [&](long long int r) {
+		return (long long int)(row_0[r % d0] == row_1[r / d0]);
+	});
+}
+
+/*
+
+Linear merge kernel: O(d0+d1) two-pointer walk
+
+*/
+long long int intersect_merge(const int* row_0, int d0, const int* row_1, int d1) {
+	long long int count = 0;
+	int i = 0, j = 0;
+
+	while (i < d0 && j < d1) {
+		if (row_0[i] < row_1[j]) i++;
+		else if (row_0[i] > row_1[j]) j++;
+		else {
+			count++;
+			i++;
+			j++;
+		}
+	}
+
+	return count;
+}
+
+typedef long long int (*intersection_kernel_t)(const int*, int, const int*, int);
+
+#ifdef ROW_INTERSECTION_X86
+
+/*
+
+AVX2 block-compare kernel: compare an 8-edge block of each row against all 8
+rotations of the other block, popcount the matched lanes, then advance
+whichever block has the smaller last column (both on a tie). Blocks are only
+retired once the other row has moved past them, so every match is counted
+exactly once. The tail falls back to the scalar merge.
+
+*/
+__attribute__((target("avx2")))
+long long int intersect_merge_avx2(const int* row_0, int d0, const int* row_1, int d1) {
+	long long int count = 0;
+	int i = 0, j = 0;
+	const __m256i rotate = _mm256_set_epi32(0, 7, 6, 5, 4, 3, 2, 1);
+
+	while (i + 8 <= d0 && j + 8 <= d1) {
+		__m256i block_0 = _mm256_loadu_si256((const __m256i*)(row_0 + i));
+		__m256i block_1 = _mm256_loadu_si256((const __m256i*)(row_1 + j));
+
+		__m256i match = _mm256_cmpeq_epi32(block_0, block_1);
+		for (int k=1; k<8; k++) {
+			block_1 = _mm256_permutevar8x32_epi32(block_1, rotate);
+			match = _mm256_or_si256(match, _mm256_cmpeq_epi32(block_0, block_1));
+		}
+		count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(match)));
+
+		int last_0 = row_0[i+7], last_1 = row_1[j+7];
+		if (last_0 <= last_1) i += 8;
+		if (last_1 <= last_0) j += 8;
+	}
+
+	return count + intersect_merge(row_0 + i, d0 - i, row_1 + j, d1 - j);
+}
+
+/*
+
+AVX-512 block-compare kernel: a 16-edge block of row_0 against an 8-edge
+block of row_1 duplicated into both 256-bit halves, so the 8 rotations that
+cover an 8x8 AVX2 block cover 16x8 here. Matches accumulate in a compare
+mask register; blocks advance as in the AVX2 kernel.
+
+*/
+__attribute__((target("avx512f")))
+long long int intersect_merge_avx512(const int* row_0, int d0, const int* row_1, int d1) {
+	// The 16-wide side moves twice as fast, so give it the longer row
+	if (d0 < d1) return intersect_merge_avx512(row_1, d1, row_0, d0);
+
+	long long int count = 0;
+	int i = 0, j = 0;
+	const __m512i rotate = _mm512_set_epi32(8, 15, 14, 13, 12, 11, 10, 9, 0, 7, 6, 5, 4, 3, 2, 1);
+
+	while (i + 16 <= d0 && j + 8 <= d1) {
+		__m512i block_0 = _mm512_loadu_si512((const void*)(row_0 + i));
+		__m512i block_1 = _mm512_broadcast_i64x4(_mm256_loadu_si256((const __m256i*)(row_1 + j)));
+
+		__mmask16 match = _mm512_cmpeq_epi32_mask(block_0, block_1);
+		for (int k=1; k<8; k++) {
+			block_1 = _mm512_permutexvar_epi32(rotate, block_1);
+			match |= _mm512_cmpeq_epi32_mask(block_0, block_1);
+		}
+		count += __builtin_popcount((unsigned int)match);
+
+		int last_0 = row_0[i+15], last_1 = row_1[j+7];
+		if (last_0 <= last_1) i += 16;
+		if (last_1 <= last_0) j += 8;
+	}
+
+	return count + intersect_merge(row_0 + i, d0 - i, row_1 + j, d1 - j);
+}
+
+#endif
+
+/*
+
+Pick the widest merge kernel this CPU supports (cpuid via
+__builtin_cpu_supports), so one binary runs on AVX2 and AVX-512 nodes alike.
+
+*/
+intersection_kernel_t resolve_merge_kernel() {
+#ifdef ROW_INTERSECTION_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) return intersect_merge_avx512;
+	if (__builtin_cpu_supports("avx2")) return intersect_merge_avx2;
+#endif
+	return intersect_merge;
+}
+
+intersection_kernel_t merge_kernel = resolve_merge_kernel();
+
+long long int intersect_merge_simd(const int* row_0, int d0, const int* row_1, int d1) {
+	return merge_kernel(row_0, d0, row_1, d1);
+}
+
+/*
+
+Galloping kernel: for each edge of the shorter row, exponential-search
+forward in the longer row from the last match position, then binary-search
+the bracketed range. O(d0 log(d1/d0)) for d0 <= d1.
+
+*/
+long long int intersect_gallop(const int* row_0, int d0, const int* row_1, int d1) {
+	if (d0 > d1) return intersect_gallop(row_1, d1, row_0, d0);
+
+	long long int count = 0;
+	int pos = 0;
+
+	for (int i=0; i<d0 && pos<d1; i++) {
+		int c = row_0[i];
+
+		// Gallop until row_1[pos+step] >= c or we run off the end
+		int step = 1;
+		while (pos+step < d1 && row_1[pos+step] < c) step <<= 1;
+
+		// Lower bound of c in row_1[pos+step/2, min(pos+step, d1-1)]
+		int lo = pos + (step >> 1), hi = (pos+step < d1) ? pos+step : d1;
+		while (lo < hi) {
+			int mid = lo + ((hi - lo) >> 1);
+			if (row_1[mid] < c) lo = mid+1;
+			else hi = mid;
+		}
+
+		pos = lo;
+		if (pos < d1 && row_1[pos] == c) {
+			count++;
+			pos++;
+		}
+	}
+
+	return count;
+}
+
+/*
+
+Merge-path co-rank: the number of row_0 edges among the first diag elements of
+the merged order of row_0 and row_1, with row_0 winning ties.
+
+A boundary that would separate a matching pair (row_0[i-1] == row_1[j]) is
+pulled back by one row_0 element so the pair lands in the same partition.
+
+*/
+void merge_path_split(const int* row_0, int d0, const int* row_1, int d1, long long int diag, int* i_out, int* j_out) {
+	int lo = (diag > d1) ? (int)(diag - d1) : 0;
+	int hi = (diag < d0) ? (int)diag : d0;
+
+	while (lo < hi) {
+		int mid = lo + ((hi - lo) >> 1);
+		if (row_0[mid] <= row_1[diag - mid - 1]) lo = mid+1;
+		else hi = mid;
+	}
+
+	int i = lo, j = (int)(diag - lo);
+	if (i > 0 && j < d1 && row_0[i-1] == row_1[j]) i--;
+
+	*i_out = i;
+	*j_out = j;
+}
+
+/*
+
+Parallel merge-path kernel: cut the merged order into equal-length diagonals,
+co-rank each cut, and run the (vectorized) linear merge on every partition
+in parallel.
+
+*/
+long long int intersect_merge_path(const int* row_0, int d0, const int* row_1, int d1) {
+	long long int total_length = (long long int)d0 + d1;
+	int partitions = (int)((total_length + MERGE_PATH_GRAIN - 1) / MERGE_PATH_GRAIN);
+
+	return parallel_sum(0, partitions, [&](int p) {
+		int i0, j0, i1, j1;
+		merge_path_split(row_0, d0, row_1, d1, ((long long int)p)*MERGE_PATH_GRAIN, &i0, &j0);
+		if (p == partitions-1) {
+			i1 = d0;
+			j1 = d1;
+		} else merge_path_split(row_0, d0, row_1, d1, ((long long int)(p+1))*MERGE_PATH_GRAIN, &i1, &j1);
+
+		return intersect_merge_simd(row_0 + i0, i1 - i0, row_1 + j0, j1 - j0);
+	});
+}
+
+/*
+
+Pick an intersection kernel from the two row lengths:
+- galloping when one row is GALLOP_RATIO times longer than the other
+- parallel merge-path when both rows together reach MERGE_PATH_MIN_LENGTH
+- linear merge otherwise, vectorized when the CPU allows
+
+*/
+long long int row_intersection_count(const int* row_0, int d0, const int* row_1, int d1) {
+	if (d0 == 0 || d1 == 0) return 0;
+
+	int d_short = (d0 < d1) ? d0 : d1;
+	int d_long = (d0 < d1) ? d1 : d0;
+
+	if (((long long int)d_short)*GALLOP_RATIO <= d_long) return intersect_gallop(row_0, d0, row_1, d1);
+	if (d0 + d1 >= MERGE_PATH_MIN_LENGTH) return intersect_merge_path(row_0, d0, row_1, d1);
+	return intersect_merge_simd(row_0, d0, row_1, d1);
+}
+
+
+/*
+
+Hybrid dense-bitmap rows
+
+Rows whose density (degree / columns) reaches a threshold also keep a bitset
+over the columns next to their CSR edges slice. At the default 1/64 density
+a bitmap costs at most twice the bytes of the row's edges, and an AND over
+its words is no longer than a merge over its edges.
+
+Key invariants:
+- bitmap_slot[r] is the index of row r's bitmap, or -1 for sparse rows
+- Bitmap k occupies bits[k*words] .. bits[(k+1)*words - 1]
+- Bit c of a bitmap is set iff column c is a nonzero of the row
+
+*/
+typedef struct row_bitmaps {
+	int words; // 64-bit words per bitmap
+	std::vector<int> bitmap_slot;
+	std::vector<unsigned long long> bits;
+} row_bitmaps;
+
+void build_row_bitmaps(row_bitmaps* b, const int* vertices, const int* edges, int rows, int columns, double density) {
+	b->words = (columns + 63) / 64;
+	b->bitmap_slot.assign(rows, -1);
+
+	// Assign slots serially, then fill the bitmaps in parallel
+	int dense_rows = 0;
+	for (int r=0; r<rows; r++) {
+		if (density > 0 && vertices[r+1] - vertices[r] >= density * columns) b->bitmap_slot[r] = dense_rows++;
+	}
+	b->bits.assign(((size_t)dense_rows) * b->words, 0);
+
+	parallel_for(0, rows, [&](int r) {
+		if (b->bitmap_slot[r] < 0) return;
+		unsigned long long* row_bits = &b->bits[((size_t)b->bitmap_slot[r]) * b->words];
+		for (int e=vertices[r]; e<vertices[r+1]; e++) row_bits[edges[e] >> 6] |= 1ULL << (edges[e] & 63);
+	});
+}
+
+/*
+
+Bitmap kernels: word-wise AND + popcount for two bitmap rows, and one bit
+probe per nonzero for a sparse row against a bitmap row.
+
+*/
+long long int intersect_bitmaps(const unsigned long long* bits_0, const unsigned long long* bits_1, int words) {
+	long long int count = 0;
+	for (int w=0; w<words; w++) count += __builtin_popcountll(bits_0[w] & bits_1[w]);
+	return count;
+}
+
+long long int intersect_bitmap_probe(const unsigned long long* bits, const int* row, int d) {
+	long long int count = 0;
+	for (int i=0; i<d; i++) count += (bits[row[i] >> 6] >> (row[i] & 63)) & 1;
+	return count;
+}
+
+/*
+
+Intersect two CSR rows, using their bitmaps where they have them and
+row_intersection_count() otherwise
+
+*/
+long long int hybrid_row_intersection(row_bitmaps* b, const int* vertices, const int* edges, int row_0_idx, int row_1_idx) {
+	int slot_0 = b->bitmap_slot[row_0_idx], slot_1 = b->bitmap_slot[row_1_idx];
+	const int* row_0 = &edges[vertices[row_0_idx]];
+	const int* row_1 = &edges[vertices[row_1_idx]];
+	int d0 = vertices[row_0_idx+1] - vertices[row_0_idx];
+	int d1 = vertices[row_1_idx+1] - vertices[row_1_idx];
+
+	if (slot_0 >= 0 && slot_1 >= 0)
+		return intersect_bitmaps(&b->bits[((size_t)slot_0) * b->words], &b->bits[((size_t)slot_1) * b->words], b->words);
+	if (slot_0 >= 0) return intersect_bitmap_probe(&b->bits[((size_t)slot_0) * b->words], row_1, d1);
+	if (slot_1 >= 0) return intersect_bitmap_probe(&b->bits[((size_t)slot_1) * b->words], row_0, d0);
+	return row_intersection_count(row_0, d0, row_1, d1);
+}
+
+#endif
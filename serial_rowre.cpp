@@ -3,10 +3,12 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <unistd.h>
 #include <vector>
 #include <algorithm>
 #include <functional>
 #include <chrono>
+#include "csr_binary.h"
 
 #define HEAP_ROOT 0
 #define LEFT_CHILD(x) 2*x+1
@@ -38,14 +40,80 @@ int metadata_columns = 0;
 int metadata_edges = 0;
 int *vertices, *edges;
 double *values;
+void* csr_mapping = NULL; // Binary container the CSR arrays point into, if any
+uint64_t csr_mapping_length = 0;
 
 // A permutation of the rows of the CSR representation.
 // *permutation must be allocated to length metadata_rows
 int *permutation;
 
+// Inverted column index (CSC transpose of vertices/edges)
+// *col_vertices must be allocated to length metadata_columns + 1
+// *col_rows must be allocated to length metadata_edges
+//
+// Key invariants:
+// - col_rows[col_vertices[c]] .. col_rows[col_vertices[c+1]-1] are the rows
+//   holding a nonzero in column c
+// - Rows are listed in ascending order and at most once per column
+// - The last element of col_vertices is the number of distinct (row, column)
+//   pairs, which is at most metadata_edges
+//
+int *col_vertices, *col_rows;
+
+// Algorithm tuning parameter
+int window = 10;
+
+// Union-window (set-semantics) affinity
+//
+// By default a row's affinity counts its columns once per window row holding
+// them (multiset). With union_window it is the number of its columns held by
+// any window row, i.e. its overlap with the union of the window's columns:
+// a column's B row is fetched once however many window rows share it. The
+// reorder then keeps a reference count of window rows per column, and rows
+// sharing a column only change affinity when that count goes 0 -> 1 or 1 -> 0.
+bool union_window = false;
+
+// Hub-column capping
+// *col_stride must be allocated to length metadata_columns
+//
+// col_stride[c] is the step taken through column c's row list when applying
+// affinity updates: 1 visits every row, k > 1 visits a fixed sample of every
+// k-th row, and 0 skips the column. Increments and window-eviction decrements
+// use the same stride, so they always touch the same rows.
+#define HUB_SKIP 0
+#define HUB_SAMPLE 1
+int hub_degree = 0; // Columns shared by more rows than this are hubs, 0 disables capping
+int hub_mode = HUB_SKIP;
+int *col_stride;
+long long int affinity_updates = 0; // Affinity key changes applied by the last reorder
+
+/*
+
+Map a binary CSR container (see csr_binary.h) redirected to stdin and point
+the CSR arrays into it. Returns false if stdin is not one.
+
+*/
+bool map_csr_binary_from_stdin() {
+	csr_mapping = map_csr_binary(STDIN_FILENO, &csr_mapping_length);
+	if (csr_mapping == NULL) return false;
+
+	const char* error = csr_binary_validate(csr_mapping, csr_mapping_length, 0);
+	if (error != NULL) {
+		fprintf(stderr, "Malformed binary CSR matrix: %s.\n", error);
+		exit(1);
+	}
+	const csr_binary_header* header = (const csr_binary_header*) csr_mapping;
+	metadata_rows = header->rows;
+	metadata_columns = header->columns;
+	metadata_edges = header->edges;
+	csr_binary_arrays(csr_mapping, &vertices, &edges, &values);
+	return true;
+}
+
 /*
 
-Load a .csr asymmetric CSR representation from stdin
+Load a .csr asymmetric CSR representation from stdin, or map a binary
+container (.csrb) redirected from a file
 
 Format:
 * Metadata line: rows columns edges
@@ -59,13 +127,19 @@ Format:
 */
 void load_mtx_csr_from_stdin() {
 
-	char *serialized_data;
-	size_t len;
+	if (map_csr_binary_from_stdin()) return;
+
+	char *serialized_data = NULL; // getline() allocates and grows the line buffer
+	size_t len = 0;
 
 //	printf("Loading CSR matrix...\n");
 //	printf("- Loading metadata line and extracting.\n");
 	assert(getline(&serialized_data, &len, stdin) != EOF);
 //	printf("%s\n",serialized_data);
+	if (is_csr_binary(serialized_data, len)) {
+		fprintf(stderr, "A binary CSR matrix must be redirected from a file, not piped.\n");
+		exit(1);
+	}
 
 	// Extract metadata
 	sscanf(serialized_data, "%d %d %d", &metadata_rows, &metadata_columns, &metadata_edges);
@@ -114,6 +188,7 @@ void load_mtx_csr_from_stdin() {
 		values[i] = value;
 		i++;
 	}
+	free(serialized_data);
 }
 
 /*
@@ -171,6 +246,126 @@ void print_csr() {
 
 }
 
+/*
+
+Build the inverted column index from the CSR representation
+
+Two-pass counting sort over edges: histogram the columns, prefix-sum into
+col_vertices, then scatter each row id into its columns. Rows are visited in
+ascending order, so every column's row list comes out sorted. A row repeating
+a column is only recorded once, matching the once-per-row match in the
+original scan loops.
+
+*/
+void build_column_index() {
+
+	col_vertices = (int *) calloc(metadata_columns + 1, sizeof(int));
+	col_rows = (int *) malloc(metadata_edges * sizeof(int));
+	int *col_last_row = (int *) malloc(metadata_columns * sizeof(int));
+
+	// Histogram the columns into col_vertices[c+1]
+	for (int c=0; c<metadata_columns; c++) col_last_row[c] = -1;
+	for (int r=0; r<metadata_rows; r++) {
+		for (int e=vertices[r]; e<vertices[r+1]; e++) {
+			int c = edges[e];
+			if (col_last_row[c] != r) {
+				col_last_row[c] = r;
+				col_vertices[c+1]++;
+			}
+		}
+	}
+
+	// Prefix-sum
+	for (int c=0; c<metadata_columns; c++) col_vertices[c+1] += col_vertices[c];
+
+	// Scatter rows into their columns
+	int *col_fill = (int *) malloc(metadata_columns * sizeof(int));
+	for (int c=0; c<metadata_columns; c++) {
+		col_fill[c] = col_vertices[c];
+		col_last_row[c] = -1;
+	}
+	for (int r=0; r<metadata_rows; r++) {
+		for (int e=vertices[r]; e<vertices[r+1]; e++) {
+			int c = edges[e];
+			if (col_last_row[c] != r) {
+				col_last_row[c] = r;
+				col_rows[col_fill[c]++] = r;
+			}
+		}
+	}
+
+	free(col_fill);
+	free(col_last_row);
+}
+
+/*
+
+Set col_stride for every column from hub_degree and hub_mode
+
+Returns the number of hub columns.
+
+*/
+int cap_hub_columns() {
+	if (col_stride == NULL) col_stride = (int *) malloc(metadata_columns * sizeof(int));
+
+	int hubs = 0;
+	for (int c=0; c<metadata_columns; c++) {
+		int degree = col_vertices[c+1] - col_vertices[c];
+		col_stride[c] = 1;
+		if (hub_degree > 0 && degree > hub_degree) {
+			hubs++;
+			// Sample roughly hub_degree rows of the column
+			col_stride[c] = (hub_mode == HUB_SKIP) ? 0 : (degree + hub_degree - 1) / hub_degree;
+		}
+	}
+
+	return hubs;
+}
+
+/*
+
+Column degree above which the top pct percent of columns lie
+
+*/
+int hub_percentile_degree(double pct) {
+	vector<int> degrees(metadata_columns);
+	for (int c=0; c<metadata_columns; c++) degrees[c] = col_vertices[c+1] - col_vertices[c];
+
+	int rank = (int)(metadata_columns * pct / 100.0);
+	if (rank <= 0 || metadata_columns == 0) return 0;
+	if (rank >= metadata_columns) rank = metadata_columns - 1;
+
+	nth_element(degrees.begin(), degrees.begin() + rank, degrees.end(), greater<int>());
+	return degrees[rank] > 0 ? degrees[rank] : 1;
+}
+
+/*
+
+Reuse quality of the current permutation: the sum over every placed row of
+its exact affinity with the window of rows placed before it, i.e. the
+objective the greedy maximizes step by step. In union mode a column counts
+once if any window row holds it.
+
+*/
+long long int window_affinity() {
+	vector<int> window_columns(metadata_columns, 0); // Window rows holding each column
+	long long int total = 0;
+
+	for (int r_permutation=0; r_permutation<metadata_rows; r_permutation++) {
+		int r_coord = permutation[r_permutation];
+		for (int e=vertices[r_coord]; e<vertices[r_coord+1]; e++)
+			total += union_window ? (window_columns[edges[e]] > 0) : window_columns[edges[e]];
+
+		for (int e=vertices[r_coord]; e<vertices[r_coord+1]; e++) window_columns[edges[e]]++;
+		if (r_permutation >= window) {
+			int r_evict = permutation[r_permutation - window];
+			for (int e=vertices[r_evict]; e<vertices[r_evict+1]; e++) window_columns[edges[e]]--;
+		}
+	}
+
+	return total;
+}
+
 // Affinity queue implementation
 
 typedef struct pq_item {
@@ -200,22 +395,10 @@ void swap_pq_positions(int i, int j, vector<pq_item>* pq, vector<int>* row_posit
 	row_positionsRef[pqRef[j].row] = j;
 }
 
-pq_item pop_row(vector<pq_item>* pq, vector<int>* row_positions) {
+void sift_down_pq(int i, vector<pq_item>* pq, vector<int>* row_positions) {
         vector<pq_item>& pqRef = *pq;
-        vector<int>& row_positionsRef = *row_positions;
 
-	pq_item result = pqRef[HEAP_ROOT];
-
-	// Remove max-affinity element
 	int heap_size = pqRef.size();
-	//printf("Popping: %d\n", pqRef[HEAP_ROOT].row);
-	row_positionsRef[pqRef[HEAP_ROOT].row] = -1;
-	overwrite_pq_position(HEAP_ROOT,heap_size-1,pq,row_positions);
-	heap_size--;
-	pqRef.pop_back();
-
-
-	int i=HEAP_ROOT;
 	bool brk=false;
 	while (LEFT_CHILD(i) < heap_size && (!brk)) {
 		// Compare to left child if right child is out-of-bounds or smaller
@@ -232,7 +415,23 @@ pq_item pop_row(vector<pq_item>* pq, vector<int>* row_positions) {
 			} else brk=true;
 		}
 	}
-	
+}
+
+pq_item pop_row(vector<pq_item>* pq, vector<int>* row_positions) {
+        vector<pq_item>& pqRef = *pq;
+        vector<int>& row_positionsRef = *row_positions;
+
+	pq_item result = pqRef[HEAP_ROOT];
+
+	// Remove max-affinity element
+	int heap_size = pqRef.size();
+	//printf("Popping: %d\n", pqRef[HEAP_ROOT].row);
+	row_positionsRef[pqRef[HEAP_ROOT].row] = -1;
+	overwrite_pq_position(HEAP_ROOT,heap_size-1,pq,row_positions);
+	heap_size--;
+	pqRef.pop_back();
+
+	sift_down_pq(HEAP_ROOT, pq, row_positions);
 
 	return result;
 }
@@ -265,27 +464,33 @@ void decrement_row_affinity(int row, vector<pq_item>* pq, vector<int>* row_posit
         //printf("****Decrementing affinity\n");
 
         // Decrement row affinity
-        int heap_size = pqRef.size();
         int i = row_positionsRef[row];
         pqRef[i].affinity--;
 
 	// Reposition in heap
-        bool brk = false;
-        while (LEFT_CHILD(i) < heap_size && (!brk)) {
-                // Compare to left child if right child is out-of-bounds or smaller
-                if (RIGHT_CHILD(i) >= heap_size || pqRef[LEFT_CHILD(i)].affinity > pqRef[RIGHT_CHILD(i)].affinity) {
-                        if (pqRef[i].affinity < pqRef[LEFT_CHILD(i)].affinity) {
-                                swap_pq_positions(i, LEFT_CHILD(i), pq, row_positions);
-                                i = LEFT_CHILD(i);
-                        } else brk=true;
-                } else {
-                        // Compare to right child
-                        if (pqRef[i].affinity < pqRef[RIGHT_CHILD(i)].affinity) {
-                                swap_pq_positions(i, RIGHT_CHILD(i), pq, row_positions);
-                                i = RIGHT_CHILD(i);
-                        } else brk=true;
-                }
-        }
+        sift_down_pq(i, pq, row_positions);
+}
+
+/*
+
+Change a row's affinity by a net delta of either sign, repositioning it once
+
+*/
+void adjust_row_affinity(int row, int delta, vector<pq_item>* pq, vector<int>* row_positions) {
+        vector<pq_item>& pqRef = *pq;
+        vector<int>& row_positionsRef = *row_positions;
+
+	int i = row_positionsRef[row];
+	pqRef[i].affinity += delta;
+	if (delta < 0) {
+		sift_down_pq(i, pq, row_positions);
+		return;
+	}
+
+	while (i > HEAP_ROOT && pqRef[i].affinity > pqRef[PARENT(i)].affinity) {
+		swap_pq_positions(i, PARENT(i), pq, row_positions);
+		i = PARENT(i);
+	}
 }
 
 void print_priority_queue(vector<pq_item>* pq, vector<int>* row_positions) {
@@ -302,115 +507,288 @@ void print_priority_queue(vector<pq_item>* pq, vector<int>* row_positions) {
 //	printf("]\n");
 }
 
-void serial_row_reorder()
-{
-	auto t1 = high_resolution_clock::now();
+/*
 
+Affinity queue engines
+
+Every engine exposes the same operations to serial_row_reorder():
+- init_queue(q): enqueue every row except row 0 with zero affinity
+- is_queued(q, row): row has not been reordered yet
+- increment_row_affinity(row, q) / decrement_row_affinity(row, q): +/-1 key change
+- adjust_row_affinity(row, delta, q): net key change of any size, in one step
+- pop_row(q): remove and return the max-affinity row
+
+*/
+
+// Heap engine: binary max-heap with a row -> heap position back-index
+typedef struct heap_queue {
 	vector<pq_item> pq; // Priority-queue for row affinities
-	vector<int> row_positions(metadata_rows, 0); // Positions of row affinities in Q
-	permutation = (int  *) malloc(metadata_rows * sizeof(int));
+	vector<int> row_positions; // Positions of row affinities in Q, -1 once reordered
+} heap_queue;
 
-        // Seed the permutation with the first row
-        permutation[0] = 0;
-	row_positions[0] = -1;
+void init_queue(heap_queue* q) {
+	q->row_positions.assign(metadata_rows, 0);
+	q->row_positions[0] = -1;
 	for (int i=1; i<metadata_rows; i++) {
 		// Add all rows to priority queue except the first
 		pq_item temp;
 		temp.row=i;
 		temp.affinity=0;
-		pq.push_back(temp);
-		row_positions[i] = i-1;
+		q->pq.push_back(temp);
+		q->row_positions[i] = i-1;
+	}
+}
+
+inline bool is_queued(heap_queue* q, int row) {
+	return q->row_positions[row] > -1;
+}
+
+inline void increment_row_affinity(int row, heap_queue* q) {
+	increment_row_affinity(row, &q->pq, &q->row_positions);
+}
+
+inline void decrement_row_affinity(int row, heap_queue* q) {
+	decrement_row_affinity(row, &q->pq, &q->row_positions);
+}
+
+inline void adjust_row_affinity(int row, int delta, heap_queue* q) {
+	adjust_row_affinity(row, delta, &q->pq, &q->row_positions);
+}
+
+inline pq_item pop_row(heap_queue* q) {
+	return pop_row(&q->pq, &q->row_positions);
+}
+
+// Bucket-queue engine: one doubly linked list of rows per affinity value,
+// plus a max pointer that only moves down on pop.
+//
+// Affinity keys are small non-negative integers that change by +/-1, so
+// every key change is an O(1) unlink/relink between adjacent buckets.
+// Within a bucket rows are kept LIFO, so ties may break differently from
+// the heap engine.
+#define BUCKET_NIL -1
+
+typedef struct bucket_queue {
+	vector<int> affinity; // Row affinities, -1 once reordered
+	vector<int> next, prev; // Bucket list links, BUCKET_NIL terminated
+	vector<int> bucket_heads; // First row of each affinity bucket, grows on demand
+	int max_affinity; // Upper bound on the highest non-empty bucket
+} bucket_queue;
+
+void init_queue(bucket_queue* q) {
+	q->affinity.assign(metadata_rows, 0);
+	q->next.assign(metadata_rows, BUCKET_NIL);
+	q->prev.assign(metadata_rows, BUCKET_NIL);
+	q->bucket_heads.assign(1, BUCKET_NIL);
+	q->max_affinity = 0;
+
+	// Add all rows to the zero bucket except the first, in ascending order from the head
+	q->affinity[0] = -1;
+	for (int i=metadata_rows-1; i>0; i--) {
+		q->next[i] = q->bucket_heads[0];
+		if (q->bucket_heads[0] != BUCKET_NIL) q->prev[q->bucket_heads[0]] = i;
+		q->bucket_heads[0] = i;
+	}
+}
+
+inline bool is_queued(bucket_queue* q, int row) {
+	return q->affinity[row] > -1;
+}
+
+inline void unlink_bucket_row(int row, bucket_queue* q) {
+	int n = q->next[row], p = q->prev[row];
+	if (p != BUCKET_NIL) q->next[p] = n;
+	else q->bucket_heads[q->affinity[row]] = n;
+	if (n != BUCKET_NIL) q->prev[n] = p;
+}
+
+inline void link_bucket_row(int row, bucket_queue* q) {
+	int head = q->bucket_heads[q->affinity[row]];
+	q->prev[row] = BUCKET_NIL;
+	q->next[row] = head;
+	if (head != BUCKET_NIL) q->prev[head] = row;
+	q->bucket_heads[q->affinity[row]] = row;
+}
+
+inline void increment_row_affinity(int row, bucket_queue* q) {
+	unlink_bucket_row(row, q);
+	q->affinity[row]++;
+	if (q->affinity[row] >= (int) q->bucket_heads.size()) q->bucket_heads.push_back(BUCKET_NIL);
+	link_bucket_row(row, q);
+	if (q->affinity[row] > q->max_affinity) q->max_affinity = q->affinity[row];
+}
+
+inline void decrement_row_affinity(int row, bucket_queue* q) {
+	unlink_bucket_row(row, q);
+	q->affinity[row]--;
+	link_bucket_row(row, q);
+}
+
+inline void adjust_row_affinity(int row, int delta, bucket_queue* q) {
+	unlink_bucket_row(row, q);
+	q->affinity[row] += delta;
+	while (q->affinity[row] >= (int) q->bucket_heads.size()) q->bucket_heads.push_back(BUCKET_NIL);
+	link_bucket_row(row, q);
+	if (q->affinity[row] > q->max_affinity) q->max_affinity = q->affinity[row];
+}
+
+pq_item pop_row(bucket_queue* q) {
+	// Walk the max pointer down to the highest non-empty bucket
+	while (q->bucket_heads[q->max_affinity] == BUCKET_NIL) q->max_affinity--;
+
+	pq_item result;
+	result.row = q->bucket_heads[q->max_affinity];
+	result.affinity = q->max_affinity;
+
+	unlink_bucket_row(result.row, q);
+	q->affinity[result.row] = -1;
+
+	return result;
+}
+
+// Lazy engine: the heap holds stale keys that are upper bounds on the true
+// affinities, which live in a flat counter array.
+//
+// Decrements only touch the counter. Increments only sift when the counter
+// climbs past the row's key (its high-water mark). On pop, a root whose key
+// disagrees with its counter is re-keyed and sifted down until the root is
+// exact; since every key bounds its row's affinity from above, an exact root
+// is a true max-affinity row.
+typedef struct lazy_queue {
+	heap_queue heap; // Keys are stale-high affinity bounds
+	vector<int> affinity; // True row affinities
+} lazy_queue;
+
+void init_queue(lazy_queue* q) {
+	init_queue(&q->heap);
+	q->affinity.assign(metadata_rows, 0);
+}
+
+inline bool is_queued(lazy_queue* q, int row) {
+	return is_queued(&q->heap, row);
+}
+
+inline void increment_row_affinity(int row, lazy_queue* q) {
+	q->affinity[row]++;
+	// The key is at least the old counter, so it only falls behind by one
+	if (q->affinity[row] > q->heap.pq[q->heap.row_positions[row]].affinity)
+		increment_row_affinity(row, &q->heap);
+}
+
+inline void decrement_row_affinity(int row, lazy_queue* q) {
+	q->affinity[row]--;
+}
+
+inline void adjust_row_affinity(int row, int delta, lazy_queue* q) {
+	q->affinity[row] += delta;
+	// Only raise the key, straight to the counter
+	int key = q->heap.pq[q->heap.row_positions[row]].affinity;
+	if (q->affinity[row] > key) adjust_row_affinity(row, q->affinity[row] - key, &q->heap);
+}
+
+pq_item pop_row(lazy_queue* q) {
+	vector<pq_item>& pqRef = q->heap.pq;
+
+	// Re-verify the root against its true counter until they agree
+	while (pqRef[HEAP_ROOT].affinity != q->affinity[pqRef[HEAP_ROOT].row]) {
+		pqRef[HEAP_ROOT].affinity = q->affinity[pqRef[HEAP_ROOT].row];
+		sift_down_pq(HEAP_ROOT, &q->heap.pq, &q->heap.row_positions);
 	}
 
-	// Algorithm tuning parameter
-	int window = 10;
+	return pop_row(&q->heap);
+}
+
+template <typename queue_type>
+long long int serial_row_reorder(queue_type* q)
+{
+	auto t1 = high_resolution_clock::now();
+
+	permutation = (int  *) malloc(metadata_rows * sizeof(int));
+
+        // Seed the permutation with the first row
+        permutation[0] = 0;
+	init_queue(q);
+	affinity_updates = 0;
 
 	// Using Fibertree notation
-	int payload_length0=0, payload_length1=0; 
-	int r0_coord=0, r1_coord=0;
-	int edge_offset0=0, edge_offset1=0;
-	int c0_pos=0, c1_pos=0, c0_coord=0;
+	int r0_coord=0, r1_coord=0, r1_pos=0;
+	int c0_coord=0;
 
-	pq_item reordered_row;
+	// Net affinity change of each row in the current step, and the rows with one
+	vector<int> row_delta(metadata_rows, 0);
+	vector<int> row_round(metadata_rows, 0);
+	vector<int> touched_rows;
+	touched_rows.reserve(metadata_rows);
+
+	// Window rows holding each column, in union mode
+	vector<int> window_refs(union_window ? metadata_columns : 0, 0);
 
-//	print_priority_queue(&pq, &row_positions);
+	pq_item reordered_row;
 
 	// Greedily reorder one row at a time
 	for (int r_permutation=1; r_permutation<metadata_rows; r_permutation++) {
 
 //		printf("r_permutation == %d\n", r_permutation);
 
-		// Examine the last reordered row, and
+		// The last reordered row enters the window and, once the window is
+		// full, the oldest row leaves it
 		r0_coord = permutation[r_permutation - 1];
+		int evicted = (r_permutation > window) ? permutation[r_permutation - window - 1] : -1;
 
 //		printf("r0_coord == %d\n", r0_coord);
 
-		// For each nonzero column position in compressed representation of the row,
-		payload_length0 = vertices[r0_coord+1] - vertices[r0_coord];
-		edge_offset0=vertices[r0_coord];
-		for (c0_pos=0; c0_pos<payload_length0; c0_pos++) {
-			c0_coord=edges[edge_offset0+c0_pos];
-			//printf("c0_coord: %d\n", c0_coord);
-
-			// For each un-reordered row, other than the one we just reordered,
-			for (r1_coord=0; r1_coord<metadata_rows; r1_coord++) {
-				if (r1_coord != r0_coord && (row_positions[r1_coord] > -1)) {
-
-					// Step positionally through this compressed row and look for a nonzero
-					// at the same position as in the row we just reordered
-					payload_length1 = vertices[r1_coord+1] - vertices[r1_coord];
-					edge_offset1=vertices[r1_coord];
-					for (c1_pos=0; edges[edge_offset1+c1_pos] < c0_coord+1; c1_pos++) {
-						//printf("edge_offset0: %d r0_coord: %d c0_coord: %d edge_offset1: %d r1_coord: %d c1_coord: %d\n", 
-						//	edge_offset0,    r0_coord,    c0_coord,    edge_offset1,    r1_coord,    edges[edge_offset1+c1_pos]);
-						if (c0_coord ==  edges[edge_offset1+c1_pos]) {
-							//increase key
-							increment_row_affinity(r1_coord, &pq, &row_positions);
-							//print_priority_queue(&pq, &row_positions);
-							payload_length1 = c1_pos; // break
-						}
+		// Fused pass: merge the two rows' sorted column lists, dropping the
+		// columns they share since their +1 and -1 cancel (in union mode they
+		// leave the column's reference count unchanged), and accumulate the
+		// net delta of every un-reordered row in the remaining columns
+		int e0 = vertices[r0_coord], e0_end = vertices[r0_coord+1];
+		int e1 = (evicted >= 0) ? vertices[evicted] : 0, e1_end = (evicted >= 0) ? vertices[evicted+1] : 0;
+		touched_rows.clear();
+		while (e0 < e0_end || e1 < e1_end) {
+			int delta;
+			if (e1 == e1_end || (e0 < e0_end && edges[e0] < edges[e1])) {
+				c0_coord = edges[e0++];
+				delta = 1;
+			} else if (e0 == e0_end || edges[e1] < edges[e0]) {
+				c0_coord = edges[e1++];
+				delta = -1;
+			} else {
+				e0++;
+				e1++;
+				continue;
+			}
+			//printf("c0_coord: %d delta: %d\n", c0_coord, delta);
+
+			// In union mode only a column entering or leaving the window union counts
+			if (union_window) {
+				window_refs[c0_coord] += delta;
+				if (window_refs[c0_coord] != (delta > 0 ? 1 : 0)) continue;
+			}
+
+			// For each un-reordered row sharing this column, other than the one we just reordered,
+			if (col_stride[c0_coord] == 0) continue;
+			for (r1_pos=col_vertices[c0_coord]; r1_pos<col_vertices[c0_coord+1]; r1_pos+=col_stride[c0_coord]) {
+				r1_coord=col_rows[r1_pos];
+				if (r1_coord != r0_coord && is_queued(q, r1_coord)) {
+					if (row_round[r1_coord] != r_permutation) {
+						row_round[r1_coord] = r_permutation;
+						row_delta[r1_coord] = 0;
+						touched_rows.push_back(r1_coord);
 					}
+					row_delta[r1_coord] += delta;
 				}
 			}
 		}
 
-		if (r_permutation > window) {
-
-	                // Examine the last reordered row, and
-        	        r0_coord = permutation[r_permutation - window - 1];
-
-	                // For each nonzero column position in compressed representation of the row,
-        	        payload_length0 = vertices[r0_coord+1] - vertices[r0_coord];
-                	edge_offset0=vertices[r0_coord];
-	                for (c0_pos=0; c0_pos<payload_length0; c0_pos++) {
-        	                c0_coord=edges[edge_offset0+c0_pos];
-
-				//printf("DECR c0_coord: %d\n", c0_coord);
-
-	                        // For each un-reordered row, other than the one we just reordered,
-        	                for (r1_coord=0; r1_coord<metadata_rows; r1_coord++) {
-                	                if (r1_coord != r0_coord && (row_positions[r1_coord] > -1)) {
-
-        	                                // Step positionally through this compressed row and look for a nonzero
-                	                        // at the same position as in the row we just reordered
-                        	                payload_length1 = vertices[r1_coord+1] - vertices[r1_coord];
-                                	        edge_offset1=vertices[r1_coord];
-	                                        for (c1_pos=0; edges[edge_offset1+c1_pos] < c0_coord+1; c1_pos++) {
-							//printf("DECR r0_coord: %d c0_coord: %d r1_coord: %d c1_coord: %d\n", r0_coord, c0_coord, r1_coord, edges[edge_offset1+c1_pos]);
-        	                                        if (c0_coord ==  edges[edge_offset1+c1_pos]) {
-								//decrease key
-								decrement_row_affinity(r1_coord, &pq, &row_positions);
-								//print_priority_queue(&pq, &row_positions);
-        	                                                payload_length1 = c1_pos; // break
-                	                                }
-                        	                }
-                                	}
-	                        }
-        	        }
-
+		// Touch each affected row's key once, with its net change
+		for (size_t i=0; i<touched_rows.size(); i++) {
+			r1_coord = touched_rows[i];
+			if (row_delta[r1_coord] == 0) continue;
+			adjust_row_affinity(r1_coord, row_delta[r1_coord], q);
+			affinity_updates++;
 		}
 
-		reordered_row=pop_row(&pq, &row_positions);
+		reordered_row=pop_row(q);
 //		printf("- reordered_row: %d affinity: %d\n", reordered_row.row, reordered_row.affinity);
 
 		permutation[r_permutation] = reordered_row.row;
@@ -420,7 +798,28 @@ void serial_row_reorder()
 
 	auto ms_int = duration_cast<milliseconds>(t2-t1);
 
-	cout<< ms_int.count() << "\n";
+	return ms_int.count();
+}
+
+/*
+
+Run serial_row_reorder() with the named affinity queue engine
+
+Returns the runtime in milliseconds, or -1 for an unknown engine.
+
+*/
+long long int reorder_with_engine(const char *engine) {
+	if (strcmp(engine, "heap") == 0) {
+		heap_queue q;
+		return serial_row_reorder(&q);
+	} else if (strcmp(engine, "bucket") == 0) {
+		bucket_queue q;
+		return serial_row_reorder(&q);
+	} else if (strcmp(engine, "lazy") == 0) {
+		lazy_queue q;
+		return serial_row_reorder(&q);
+	}
+	return -1;
 }
 
 void print_permutation() {
@@ -430,16 +829,101 @@ void print_permutation() {
 }
 
 void free_all() {
-	free(vertices);
-	free(edges);
-	free(values);
+	if (csr_mapping != NULL) {
+		munmap(csr_mapping, csr_mapping_length);
+	} else {
+		free(vertices);
+		free(edges);
+		free(values);
+	}
 	free(permutation);
+	free(col_vertices);
+	free(col_rows);
+	free(col_stride);
 }
 
-int main() {
+void print_usage(char *prog) {
+	fprintf(stderr, "Usage: %s [-e heap|bucket|lazy] [-u] [-H degree|pct%%] [-m skip|sample] [-R] [-p] < mat.csr\n", prog);
+	fprintf(stderr, "  -e  affinity queue engine (default: heap)\n");
+	fprintf(stderr, "  -u  union-window affinity: count a row's columns held by any window row, once each\n");
+	fprintf(stderr, "  -H  treat columns shared by more than this many rows, or the top pct%% of columns, as hubs\n");
+	fprintf(stderr, "  -m  hub columns are skipped or sampled down to about the -H degree (default: skip)\n");
+	fprintf(stderr, "  -R  also run without hub capping and report runtime saved and reuse quality lost\n");
+	fprintf(stderr, "  -p  print the row permutation after the runtime\n");
+}
+
+int main(int argc, char *argv[]) {
+	const char *engine = "heap";
+	const char *hub_arg = NULL;
+	bool print_perm = false, report_baseline = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "e:uH:m:Rp")) != -1) {
+		switch (opt) {
+			case 'e': engine = optarg; break;
+			case 'u': union_window = true; break;
+			case 'H': hub_arg = optarg; break;
+			case 'm':
+				if (strcmp(optarg, "skip") == 0) hub_mode = HUB_SKIP;
+				else if (strcmp(optarg, "sample") == 0) hub_mode = HUB_SAMPLE;
+				else {
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'R': report_baseline = true; break;
+			case 'p': print_perm = true; break;
+			default: print_usage(argv[0]); return 1;
+		}
+	}
+
 	load_mtx_csr_from_stdin();
 //	print_csr();
-	serial_row_reorder();
-//	print_permutation();
+	build_column_index();
+
+	if (hub_arg != NULL) {
+		if (hub_arg[strlen(hub_arg)-1] == '%') hub_degree = hub_percentile_degree(atof(hub_arg));
+		else hub_degree = atoi(hub_arg);
+	}
+	int hubs = cap_hub_columns();
+
+	long long int ms = reorder_with_engine(engine);
+	if (ms < 0) {
+		print_usage(argv[0]);
+		return 1;
+	}
+	cout<< ms << "\n";
+
+	if (hub_degree > 0) {
+		long long int quality = window_affinity();
+		printf("Hub columns: %d of %d (degree > %d, %s)\n", hubs, metadata_columns, hub_degree, hub_mode == HUB_SKIP ? "skipped" : "sampled");
+		printf("Affinity updates: %lld\n", affinity_updates);
+		printf("Window affinity: %lld\n", quality);
+
+		if (report_baseline) {
+			// Rerun uncapped, keeping the capped permutation for -p
+			int *capped_permutation = permutation;
+			long long int capped_updates = affinity_updates;
+			int capped_hub_degree = hub_degree;
+
+			hub_degree = 0;
+			cap_hub_columns();
+			long long int baseline_ms = reorder_with_engine(engine);
+			long long int baseline_quality = window_affinity();
+			free(permutation);
+			permutation = capped_permutation;
+			hub_degree = capped_hub_degree;
+
+			printf("Uncapped runtime: %lld ms, affinity updates: %lld, window affinity: %lld\n", baseline_ms, affinity_updates, baseline_quality);
+			printf("Runtime saved: %lld ms (%.1f%%)\n", baseline_ms - ms, baseline_ms > 0 ? 100.0 * (baseline_ms - ms) / baseline_ms : 0.0);
+			printf("Affinity updates saved: %lld (%.1f%%)\n", affinity_updates - capped_updates, affinity_updates > 0 ? 100.0 * (affinity_updates - capped_updates) / affinity_updates : 0.0);
+			printf("Reuse quality lost: %lld (%.1f%%)\n", baseline_quality - quality, baseline_quality > 0 ? 100.0 * (baseline_quality - quality) / baseline_quality : 0.0);
+		}
+	} else if (union_window) {
+		printf("Affinity updates: %lld\n", affinity_updates);
+		printf("Window affinity (union): %lld\n", window_affinity());
+	}
+
+	if (print_perm) print_permutation();
 	free_all();
 }
@@ -1,23 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <assert.h>
+#include <unistd.h>
+#include "csr_binary.h"
 
-#define NO_INDEX -1 // Initial index value when converting adjacency list format to CSR
+#define SPOOL_BLOCK (1 << 20) // Bytes copied per read when spooling piped input
 
-// Adjacency list graph edge structure 
-// User must enforce uni- or bi-directionality
-typedef struct adjacency_edge {
-	int source;
-	int destination;
-	double value;
-} adjacency_edge;
-
-// Asymmetric adjacency list representation
-// *edges must be allocated to length metadata_edges
+// Asymmetric matrix metadata, from the .mtx metadata line
 int metadata_rows = 0;
 int metadata_columns = 0;
 int metadata_edges = 0;
-adjacency_edge *adjacency_list;
 
 // Asymmetric compressed-sparse row (CSR) representation
 // *edges and *values must be allocated to length metadata_edges
@@ -25,7 +16,7 @@ adjacency_edge *adjacency_list;
 //
 // Key invariants:
 // - Each edge is a destination node from the adjacency list
-// - edges maintains the sorted order of the adjacency list
+// - Within a row, edges keep the order of the .mtx lines (the sort is stable)
 // - vertices is sorted (i.e. index corresponds to vertex id)
 // - The egress-degree of vertex v is vertices[v+1] - vertices[v]
 // - The last element of vertices is a dummy equal to metadata_edges,
@@ -34,148 +25,157 @@ adjacency_edge *adjacency_list;
 int *vertices, *edges;
 double *values;
 
-/* 
-
-Load a .mtx unsorted asymmetric adjacency list from stdin 
+/*
 
-Format:
-* Comment preamble
-* Metadata line
-* One edge per line
-* EOF
+Return a seekable stream over stdin: stdin itself when it is redirected from
+a file, otherwise a temporary file holding everything piped in
 
 */
-void load_mtx_unsorted_asymmetric_adjacency_list_from_stdin() {
-	char *serialized_data;
-	size_t len;
+FILE *seekable_stdin() {
+	if (fseek(stdin, 0, SEEK_CUR) == 0) return stdin;
+
+	printf("- Spooling piped input to a temporary file...\n");
+	FILE *spool = tmpfile();
+	char *block = (char *) malloc(SPOOL_BLOCK);
+	size_t got;
+	if (spool == NULL || block == NULL) {
+		fprintf(stderr, "Failed to spool stdin.\n");
+		exit(1);
+	}
+	while ((got = fread(block, 1, SPOOL_BLOCK, stdin)) > 0) {
+		if (fwrite(block, 1, got, spool) != got) {
+			fprintf(stderr, "Failed to spool stdin.\n");
+			exit(1);
+		}
+	}
+	free(block);
+	rewind(spool);
+	return spool;
+}
 
-	printf("Loading adjacency list...");
+/*
 
-	printf("- Skipping comment preamble...\n");
+Skip the comment preamble and parse the metadata line
 
-	// Scan through .mtx comment preamble until serialized_data holds the metadata line
-	while (getline(&serialized_data, &len, stdin) != EOF && serialized_data[0] == '%');
+*/
+void load_mtx_metadata(FILE *in, char **serialized_data, size_t *len) {
 
-	printf("- Extracting metadata...\n");
+	ssize_t got;
 
-	printf("%s\n",serialized_data);
+	// Scan through .mtx comment preamble until serialized_data holds the metadata line
+	while ((got = getline(serialized_data, len, in)) != EOF && (*serialized_data)[0] == '%');
 
 	// Extract metadata
-	sscanf(serialized_data, "%d %d %d", &metadata_rows, &metadata_columns, &metadata_edges);
-
-	printf("- Rows: %d Columns: %d Edges: %d\n", metadata_rows, metadata_columns, metadata_edges);
-
-	printf("- Allocating adjacency list memory...\n");
-
-	// Allocate adjacency list memory
-	adjacency_list = (adjacency_edge *) malloc(metadata_edges * sizeof(adjacency_edge));
-	
-	printf("- Loading edges...\n");
+	if (got == EOF || sscanf(*serialized_data, "%d %d %d", &metadata_rows, &metadata_columns, &metadata_edges) != 3) {
+		fprintf(stderr, "Malformed .mtx metadata line.\n");
+		exit(1);
+	}
+}
 
-	// Load edges 
-	for (int i=0; i<metadata_edges; i++) {
+/*
 
-                assert(getline(&serialized_data, &len, stdin) != EOF);
+Read the next edge line and parse its source, plus its destination and value
+unless source_only, converting the 1-indexing of vertices to 0-indexing
 
-		sscanf(serialized_data, "%d %d %lf", &adjacency_list[i].source, &adjacency_list[i].destination, &adjacency_list[i].value);
+*/
+void load_mtx_edge(FILE *in, char **serialized_data, size_t *len, int source_only, int *source, int *destination, double *value) {
 
-		// Convert 1-indexing of vertices to 0-indexing
-		adjacency_list[i].source -= 1;
-		adjacency_list[i].destination -= 1;
+	char *field, *end;
+	if (getline(serialized_data, len, in) == EOF) {
+		fprintf(stderr, "Malformed .mtx: fewer edge lines than the metadata line declares.\n");
+		exit(1);
 	}
+	*source = strtol(*serialized_data, &end, 10) - 1;
+	if (*source < 0 || *source >= metadata_rows) {
+		fprintf(stderr, "Malformed .mtx: edge source %d outside the %d rows.\n", *source + 1, metadata_rows);
+		exit(1);
+	}
+	if (source_only) return;
 
-	printf("Done.\n");
+	field = end;
+	*destination = strtol(field, &end, 10) - 1;
+	if (end == field) {
+		fprintf(stderr, "Malformed .mtx: edge line without a destination.\n");
+		exit(1);
+	}
+	// Pattern matrices have no value column
+	*value = strtod(end, NULL);
 }
 
-/*
+/* 
 
-Compare two graph edges by their source
+Convert a .mtx unsorted asymmetric adjacency list from stdin to CSR format,
+by a two-pass counting sort on the edge sources
 
-*/
-int cmpfunc (const void * a, const void * b) {
-	return ( (*(adjacency_edge *)a).source - (*(adjacency_edge *)b).source );
-}
-
-/*
+Format:
+* Comment preamble
+* Metadata line
+* One edge per line
+* EOF
 
-Sort adjacency list by edge source
+Pass 1 histograms the sources into vertices, which a prefix sum turns into
+row offsets. Pass 2 re-reads the edges and scatters each destination and
+value straight to its row's next free slot in edges/values, bumping
+vertices[source] as the cursor; shifting vertices up one slot afterwards
+restores the offsets. The edges are never held as an adjacency list, so
+the peak is the CSR arrays alone, and the whole conversion is linear.
 
 */
-void qsort_adjacency_list() {
+void convert_mtx_to_csr_from_stdin() {
+	char *serialized_data = NULL; // getline() allocates and grows the line buffer
+	size_t len = 0;
+	int source, destination;
+	double value;
 
-	printf("Sorting adjacency list.\n");
+	printf("Converting adjacency list to CSR format...\n");
 
-	qsort(adjacency_list, metadata_edges, sizeof(adjacency_edge), cmpfunc);
-}
+	FILE *in = seekable_stdin();
+	fpos_t body;
 
-/*
+	printf("- Extracting metadata...\n");
 
-Convert loaded adjacency list to CSR format
+	load_mtx_metadata(in, &serialized_data, &len);
+	fgetpos(in, &body);
 
-*/
-void convert_adjacency_list_to_csr() {
+	printf("%s\n",serialized_data);
 
-	printf("Converting adjacency list to CSR format.\n");
+	printf("- Rows: %d Columns: %d Edges: %d\n", metadata_rows, metadata_columns, metadata_edges);
 
 	printf("- Allocating CSR memory.\n");
 
 	edges = (int *) malloc(metadata_edges * sizeof(int));
 	values = (double *) malloc(metadata_edges * sizeof(double));
-	vertices = (int  *) malloc((metadata_rows + 1) * sizeof(int));
-
-	printf("- Converting adjacency list to CSR.\n");
-
-	int prev_edge_edx = 0, source_last_seen = NO_INDEX;
+	vertices = (int  *) calloc(metadata_rows + 1, sizeof(int));
 
-	for (int edx=0; edx < metadata_edges; edx++) {
-
-		edges[edx] = adjacency_list[edx].destination;
-		values[edx] = adjacency_list[edx].value;
-
-		if (adjacency_list[edx].source != source_last_seen) {
-
-			for (int vdx=source_last_seen + 1; vdx < adjacency_list[edx].source + 1; vdx++) {
-				vertices[vdx] = edx;
-			}
-
-			source_last_seen = adjacency_list[edx].source;
-		}
+	printf("- Counting edges per source...\n");
 
+	// Pass 1: vertices[v+1] counts the edges of v
+	for (int i=0; i<metadata_edges; i++) {
+		load_mtx_edge(in, &serialized_data, &len, 1, &source, &destination, &value);
+		vertices[source + 1]++;
 	}
 
-	vertices[metadata_rows] = metadata_edges;
+	// Prefix sum: vertices[v] is the first edge of v
+	for (int v=0; v<metadata_rows; v++) vertices[v + 1] += vertices[v];
 
-}
-
-/*
-
-Print head/tail of loaded, sorted adjacency list
-
-*/
-void print_adjacency_list() {
-
-	printf("- Sorted adjacency list preview:\n\n");
-
-	// Print head
-	for (int i=0; i < ((10 < metadata_edges) ? 10 : metadata_edges); i++) {
-
-		printf("edges[%d] == %d %d %lf\n", i, adjacency_list[i].source, adjacency_list[i].destination, adjacency_list[i].value);
+	printf("- Scattering edges...\n");
 
+	// Pass 2: vertices[v] is the next free edge of v, ending at the first edge of v+1
+	fsetpos(in, &body);
+	for (int i=0; i<metadata_edges; i++) {
+		load_mtx_edge(in, &serialized_data, &len, 0, &source, &destination, &value);
+		int edx = vertices[source]++;
+		edges[edx] = destination;
+		values[edx] = value;
 	}
 
-	printf("\n...\n\n");
-
-	if (10 < metadata_edges) {
+	for (int v=metadata_rows; v>0; v--) vertices[v] = vertices[v - 1];
+	vertices[0] = 0;
 
-        	// Print tail
-        	for (int i=((10 > metadata_edges - 10) ? 10 : (metadata_edges - 10)); i < metadata_edges; i++) {
-
-                	printf("edges[%d] == %d %d %lf\n", i, adjacency_list[i].source, adjacency_list[i].destination, adjacency_list[i].value);
-
-	        }
-
-	}
+	free(serialized_data);
+	if (in != stdin) fclose(in);
 
+	printf("Done.\n");
 }
 
 /*
@@ -263,26 +263,52 @@ void save_csr() {
 
 }
 
+/*
+
+Save CSR representation to a binary container file (see csr_binary.h).
+
+*/
+
+void save_csr_binary() {
+	FILE * fp;
+
+	fp = fopen("mat.csrb", "wb");
+
+	printf("Saving CSR representation to binary file.\n");
+	if (fp == NULL || !write_csr_binary(fp, metadata_rows, metadata_columns, metadata_edges, vertices, edges, values)) {
+		fprintf(stderr, "Failed to write mat.csrb.\n");
+		exit(1);
+	}
+
+	fclose(fp);
+
+}
+
 void free_all() {
-	free(adjacency_list);
 	free(vertices);
 	free(edges);
 	free(values);
 }
 
-int main(void) {
-
-	load_mtx_unsorted_asymmetric_adjacency_list_from_stdin();
-
-	qsort_adjacency_list();
+int main(int argc, char *argv[]) {
 
-	print_adjacency_list();
+	// -b writes mat.csrb instead of mat.csr
+	int binary = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "b")) != -1) {
+		if (opt == 'b') binary = 1;
+		else {
+			fprintf(stderr, "Usage: %s [-b] < /path/to/mtx\n", argv[0]);
+			return 1;
+		}
+	}
 
-	convert_adjacency_list_to_csr();
+	convert_mtx_to_csr_from_stdin();
 
 	print_csr();
 
-	save_csr();
+	if (binary) save_csr_binary();
+	else save_csr();
 
 	free_all();
 
@@ -0,0 +1,229 @@
+#ifndef TOURNAMENT_TREE_H
+#define TOURNAMENT_TREE_H
+
+#include <vector>
+#include <algorithm>
+#include "parallel_runtime.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOURNAMENT_TREE_X86
+#endif
+
+// Tournament (segment-max) tree over a row affinity array
+//
+// The reorderers keep one long long affinity per row, -1 once the row is
+// reordered. Instead of scanning the whole array for the next row, the tree
+// keeps the argmax of every block of TOURNAMENT_BLOCK consecutive rows as a
+// leaf and the winner of each pair of children above it, so the next row is
+// the root and a changed affinity only replays its leaf block and its path.
+//
+// Ties go to the lower row, so the selection is deterministic.
+#define TOURNAMENT_BLOCK_SHIFT 6
+#define TOURNAMENT_BLOCK (1 << TOURNAMENT_BLOCK_SHIFT) // Rows per leaf block
+
+/*
+
+Block argmax kernels: index of the largest of keys[start] ..
+keys[start+TOURNAMENT_BLOCK-1], the lowest such index on ties. The SIMD
+kernels find the maximum with lane-wise max, then the first lane equal to it.
+
+*/
+typedef int (*block_argmax_t)(const long long int* keys, int start);
+
+int block_argmax(const long long int* keys, int start) {
+	int best = start;
+	for (int i=start+1; i<start+TOURNAMENT_BLOCK; i++) if (keys[i] > keys[best]) best = i;
+	return best;
+}
+
+#ifdef TOURNAMENT_TREE_X86
+__attribute__((target("avx2")))
+int block_argmax_avx2(const long long int* keys, int start) {
+	const __m256i* block = (const __m256i*) &keys[start];
+	__m256i best = _mm256_loadu_si256(block);
+	for (int i=1; i<TOURNAMENT_BLOCK/4; i++) {
+		__m256i v = _mm256_loadu_si256(block + i);
+		best = _mm256_blendv_epi8(best, v, _mm256_cmpgt_epi64(v, best));
+	}
+
+	long long int lanes[4];
+	_mm256_storeu_si256((__m256i*) lanes, best);
+	long long int max_key = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+
+	__m256i target = _mm256_set1_epi64x(max_key);
+	for (int i=0; i<TOURNAMENT_BLOCK/4; i++) {
+		int hit = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_loadu_si256(block + i), target)));
+		if (hit) return start + 4*i + __builtin_ctz(hit);
+	}
+	return start;
+}
+
+__attribute__((target("avx512f")))
+int block_argmax_avx512(const long long int* keys, int start) {
+	__m512i best = _mm512_loadu_si512(&keys[start]);
+	for (int i=8; i<TOURNAMENT_BLOCK; i+=8) best = _mm512_max_epi64(best, _mm512_loadu_si512(&keys[start+i]));
+
+	__m512i target = _mm512_set1_epi64(_mm512_reduce_max_epi64(best));
+	for (int i=0; i<TOURNAMENT_BLOCK; i+=8) {
+		__mmask8 hit = _mm512_cmpeq_epi64_mask(_mm512_loadu_si512(&keys[start+i]), target);
+		if (hit) return start + i + __builtin_ctz(hit);
+	}
+	return start;
+}
+#endif
+
+block_argmax_t resolve_block_argmax() {
+#ifdef TOURNAMENT_TREE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) return block_argmax_avx512;
+	if (__builtin_cpu_supports("avx2")) return block_argmax_avx2;
+#endif
+	return block_argmax;
+}
+
+block_argmax_t block_argmax_kernel = resolve_block_argmax();
+
+/*
+
+Tree layout, heap-ordered with the root at 1
+
+Key invariants:
+- size is the number of leaf blocks rounded up to a power of two
+- winner[size+b] is the argmax row of block b, or -1 for padding blocks
+- winner[i] for 1 <= i < size is the better of winner[2i] and winner[2i+1]
+- The keys array is owned by the caller, who must update the tree after
+  changing any key
+- dirty is batch-update scratch, reserved for every row at build time so
+  updates never allocate
+
+*/
+typedef struct tournament_tree {
+	const long long int* keys;
+	int rows;
+	int size;
+	std::vector<int> winner;
+	std::vector<int> dirty;
+} tournament_tree;
+
+inline int tournament_better(const tournament_tree* t, int a, int b) {
+	if (a < 0) return b;
+	if (b < 0) return a;
+	if (t->keys[a] > t->keys[b] || (t->keys[a] == t->keys[b] && a < b)) return a;
+	return b;
+}
+
+inline int tournament_block_winner(const tournament_tree* t, int b) {
+	int start = b * TOURNAMENT_BLOCK;
+	if (start + TOURNAMENT_BLOCK <= t->rows) return block_argmax_kernel(t->keys, start);
+
+	// The last block may be partial
+	int best = start;
+	for (int i=start+1; i<t->rows; i++) if (t->keys[i] > t->keys[best]) best = i;
+	return best;
+}
+
+void build_tournament_tree(tournament_tree* t, const long long int* keys, int rows) {
+	int blocks = (rows + TOURNAMENT_BLOCK - 1) / TOURNAMENT_BLOCK;
+	t->keys = keys;
+	t->rows = rows;
+	t->size = 1;
+	while (t->size < blocks) t->size <<= 1;
+	t->winner.assign(2 * t->size, -1);
+	t->dirty.reserve(rows);
+
+	parallel_for(0, blocks, [&](int b) { t->winner[t->size + b] = tournament_block_winner(t, b); });
+
+	// Each level in parallel, bottom-up
+	for (int level_start=t->size/2; level_start>=1; level_start/=2) {
+		parallel_for(level_start, 2*level_start, [&](int i) {
+			t->winner[i] = tournament_better(t, t->winner[2*i], t->winner[2*i+1]);
+		});
+	}
+}
+
+/*
+
+Highest-key row, or -1 if every row has key -1
+
+*/
+inline int tournament_top(const tournament_tree* t) {
+	int top = t->winner[1];
+	if (top < 0 || t->keys[top] == (long long int)-1) return -1;
+	return top;
+}
+
+/*
+
+Point update: replay row's leaf block, then its leaf-to-root path
+
+*/
+void tournament_update(tournament_tree* t, int row) {
+	int node = t->size + row / TOURNAMENT_BLOCK;
+	t->winner[node] = tournament_block_winner(t, row / TOURNAMENT_BLOCK);
+	for (node/=2; node>=1; node/=2) t->winner[node] = tournament_better(t, t->winner[2*node], t->winner[2*node+1]);
+}
+
+/*
+
+Batch update after many keys changed: the distinct dirty leaf blocks are
+replayed in parallel, then each level's distinct dirty parents in parallel,
+so paths shared by several changed rows are replayed once. Once a quarter
+of the blocks are dirty, whole levels are replayed instead.
+
+*/
+void tournament_replay_dirty(tournament_tree* t) {
+	std::vector<int>& nodes = t->dirty;
+	int count = nodes.size();
+	if (count == 0) return;
+
+	if (count >= t->size / 4) {
+		parallel_for(0, count, [&](int i) { t->winner[t->size + nodes[i]] = tournament_block_winner(t, nodes[i]); });
+		for (int level_start=t->size/2; level_start>=1; level_start/=2) {
+			parallel_for(level_start, 2*level_start, [&](int i) {
+				t->winner[i] = tournament_better(t, t->winner[2*i], t->winner[2*i+1]);
+			});
+		}
+		return;
+	}
+
+	parallel_for(0, count, [&](int i) {
+		t->winner[t->size + nodes[i]] = tournament_block_winner(t, nodes[i]);
+		nodes[i] += t->size;
+	});
+
+	while (nodes[0] > 1) {
+		// Halving keeps the node list sorted, so duplicates stay adjacent
+		for (size_t i=0; i<nodes.size(); i++) nodes[i] /= 2;
+		nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+		parallel_for(0, (int)nodes.size(), [&](int i) {
+			t->winner[nodes[i]] = tournament_better(t, t->winner[2*nodes[i]], t->winner[2*nodes[i]+1]);
+		});
+	}
+}
+
+/*
+
+Batch update from a list of distinct dirty blocks
+
+*/
+void tournament_update_blocks(tournament_tree* t, const int* blocks, int count) {
+	t->dirty.assign(blocks, blocks + count);
+	std::sort(t->dirty.begin(), t->dirty.end());
+	tournament_replay_dirty(t);
+}
+
+/*
+
+Batch update from the changed rows themselves
+
+*/
+void tournament_update_batch(tournament_tree* t, const int* rows, int count) {
+	std::vector<int>& blocks = t->dirty;
+	blocks.resize(count);
+	parallel_for(0, count, [&](int i) { blocks[i] = rows[i] / TOURNAMENT_BLOCK; });
+	std::sort(blocks.begin(), blocks.end());
+	blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+	tournament_replay_dirty(t);
+}
+
+#endif
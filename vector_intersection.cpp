@@ -0,0 +1,98 @@
+#include <iostream>
+#include <cstdio>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include "row_intersection.h"
+
+using namespace std;
+using chrono::high_resolution_clock;
+using chrono::duration_cast;
+using chrono::duration;
+using chrono::nanoseconds;
+
+// Microbenchmark parameters
+int d0 = 0; // Nonzeros in the first synthetic row
+int d1 = 0; // Nonzeros in the second synthetic row
+int metadata_columns = 0; // Column universe both rows are drawn from
+int iterations = 0;
+
+vector<int> row_0, row_1;
+
+/*
+
+Draw a sorted, duplicate-free synthetic row of the given degree
+
+*/
+void random_sorted_row(vector<int>* row, int degree, mt19937* rng) {
+	vector<int>& rowRef = *row;
+
+	// Floyd's sampling of degree distinct columns
+	vector<char> taken(metadata_columns, 0);
+	for (int j=metadata_columns-degree; j<metadata_columns; j++) {
+		int c = (*rng)() % (j+1);
+		if (taken[c]) c = j;
+		taken[c] = 1;
+		rowRef.push_back(c);
+	}
+	sort(rowRef.begin(), rowRef.end());
+}
+
+/*
+
+Time one kernel over all iterations and print ns per call and edges per second
+
+*/
+long long int bench_kernel(const char* name, intersection_kernel_t kernel) {
+	long long int count = 0;
+
+	auto t1 = high_resolution_clock::now();
+	for (int it=0; it<iterations; it++) count += kernel(row_0.data(), d0, row_1.data(), d1);
+	auto t2 = high_resolution_clock::now();
+
+	double ns = duration_cast<nanoseconds>(t2-t1).count();
+	printf("%-10s %12.1f ns/call %10.3f Gedges/s  intersection %lld\n", name, ns/iterations,
+	       ((double)(d0 + d1))*iterations/ns, count/iterations);
+
+	return count;
+}
+
+int main(int argc, char *argv[]) {
+
+	assert(argc == 5);
+
+	d0 = atoi(argv[1]);
+	d1 = atoi(argv[2]);
+	metadata_columns = atoi(argv[3]);
+	iterations = atoi(argv[4]);
+	assert(d0 <= metadata_columns && d1 <= metadata_columns && iterations > 0);
+
+	mt19937 rng(1);
+	random_sorted_row(&row_0, d0, &rng);
+	random_sorted_row(&row_1, d1, &rng);
+
+	printf("d0 %d d1 %d columns %d iterations %d\n", d0, d1, metadata_columns, iterations);
+
+	// Every kernel must agree with the scalar merge
+	long long int expected = bench_kernel("merge", intersect_merge);
+	bool agree = true;
+#ifdef ROW_INTERSECTION_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) agree &= bench_kernel("avx2", intersect_merge_avx2) == expected;
+	if (__builtin_cpu_supports("avx512f")) agree &= bench_kernel("avx512", intersect_merge_avx512) == expected;
+#endif
+	agree &= bench_kernel("gallop", intersect_gallop) == expected;
+	agree &= bench_kernel("mergepath", intersect_merge_path) == expected;
+	agree &= bench_kernel("auto", row_intersection_count) == expected;
+
+	if (!agree) {
+		fprintf(stderr, "Kernel results disagree.\n");
+		return 1;
+	}
+
+	return 0;
+}